@@ -0,0 +1,61 @@
+/**
+ * \file arena.c
+ *
+ * Chunked memory arena for item texts.
+ *
+ * Small allocations are placed one after another in chunks of
+ * #ARENA_CHUNK_SIZE bytes. Allocations larger than #ARENA_LARGE_SIZE
+ * get chunk of their own so long items don't leave large unused space
+ * at end of chunks.
+ */
+#include "arena.h"
+
+/** size of a chunk */
+#define ARENA_CHUNK_SIZE (1 << 20)
+/** minimal size of allocation placed in separate chunk */
+#define ARENA_LARGE_SIZE (ARENA_CHUNK_SIZE / 16)
+
+/** Creates empty arena. */
+Arena *arena_new(void)
+{
+    Arena *arena = g_new0(Arena, 1);
+
+    arena->chunks = g_ptr_array_new();
+
+    return arena;
+}
+
+/** Adds new chunk of \a size bytes to \a arena. */
+gchar *arena_add_chunk(Arena *arena, gsize size)
+{
+    gchar *chunk = g_malloc(size);
+
+    g_ptr_array_add(arena->chunks, chunk);
+    arena->allocated += size;
+
+    return chunk;
+}
+
+/**
+ * Allocates \a size bytes in \a arena.
+ * \returns pointer to allocated memory (valid until end of the program)
+ */
+gchar *arena_alloc(Arena *arena, gsize size)
+{
+    gchar *result;
+
+    arena->used += size;
+
+    if (size >= ARENA_LARGE_SIZE)
+        return arena_add_chunk(arena, size);
+
+    if ( (gsize)(arena->end - arena->pos) < size ) {
+        arena->pos = arena_add_chunk(arena, ARENA_CHUNK_SIZE);
+        arena->end = arena->pos + ARENA_CHUNK_SIZE;
+    }
+
+    result = arena->pos;
+    arena->pos += size;
+
+    return result;
+}
@@ -0,0 +1,32 @@
+/**
+ * \file arena.h
+ *
+ * Chunked memory arena for item texts.
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <glib.h>
+
+/**
+ * Memory arena.
+ * Memory is allocated in large chunks and never freed or moved
+ * (so pointers to allocated memory stay valid).
+ */
+typedef struct {
+    /** allocated chunks */
+    GPtrArray *chunks;
+    /** free space in current chunk */
+    gchar *pos;
+    /** end of current chunk */
+    gchar *end;
+    /** number of bytes allocated by #arena_alloc */
+    gsize used;
+    /** number of bytes allocated in all chunks */
+    gsize allocated;
+} Arena;
+
+Arena *arena_new(void);
+gchar *arena_alloc(Arena *arena, gsize size);
+
+#endif /* ARENA_H */
@@ -0,0 +1,402 @@
+/**
+ * \file filter.c
+ *
+ * Evaluating visibility of items in thread pool.
+ *
+ * #filter_start splits items in store into chunks of #FILTER_CHUNK_SIZE
+ * items which are matched with query in worker threads. Each worker writes
+ * visibility only to flags of items in its chunk (see
+ * #item_store_set_visible), so locking is needed only for bookkeeping of
+ * chunks. #filter_start returns immediately; caller polls
+ * #filter_get_progress and can show results for processed items while the
+ * rest is being filtered.
+ *
+ * Pass can be restricted to candidate items found in an index
+ * (#filter_start_candidates, see trigram_index.h and fm_index.h); chunks
+ * then contain candidates instead of all items. Candidates are looked up by
+ * the first task of the pass in a worker thread, so the caller doesn't wait
+ * for the index; chunks are queued after the lookup.
+ *
+ * Each pass has a generation number. Starting a new pass (or calling
+ * #filter_cancel) increments the generation so chunks of the older pass are
+ * skipped; chunks which are already being processed are waited for, so an
+ * old pass is aborted at the next chunk boundary and never overwrites
+ * results of a newer one. Lookup of candidates is not waited for: it uses
+ * its own copy of the query and its result is dropped if the pass was
+ * cancelled in the meantime.
+ *
+ * Store must not be modified and query must stay valid until the pass is
+ * finished or cancelled.
+ */
+#include "filter.h"
+
+#include <string.h>
+
+/** number of items matched in a single task */
+#define FILTER_CHUNK_SIZE 16384
+
+/** chunk of items (or lookup of candidates) queued in thread pool */
+typedef struct {
+    /** generation of pass which queued the chunk */
+    guint generation;
+    /** chunk number */
+    guint chunk;
+    /** function finding candidates (NULL if task is not lookup) */
+    FilterFindFunc find;
+    /** index for FilterTask::find */
+    gpointer index;
+    /** copy of query for FilterTask::find */
+    Query *query;
+} FilterTask;
+
+struct _Filter {
+    /** worker threads */
+    GThreadPool *pool;
+    /** number of threads */
+    guint threads;
+
+    /**\{ \name Current pass */
+    /** store with items */
+    ItemStore *store;
+    /** compiled filter text */
+    const Query *query;
+    /** Match only visible items (others stay hidden). */
+    gboolean visible_only;
+    /** first item to filter (visibility of previous items is final) */
+    guint from;
+    /** number of items in store */
+    guint len;
+    /** items to filter (ascending indexes) or NULL to filter all items */
+    GArray *candidates;
+    /** chunks processed (one byte per chunk) */
+    GByteArray *done;
+    /** number of chunks processed from the first one */
+    guint progress;
+    /** candidates are being looked up (no chunk is queued yet) */
+    gboolean lookup;
+    /**\}*/
+
+    /**
+     * lock for following members and for Filter::done, Filter::progress,
+     * Filter::lookup and Filter::candidates
+     */
+    GMutex lock;
+    /** generation of current pass */
+    guint generation;
+    /** number of chunks being processed */
+    guint running;
+    /** signaled if no chunk is being processed */
+    GCond idle;
+};
+
+/** Sets visibility and score of item \a index. */
+void filter_item(Filter *filter, guint index)
+{
+    const Item *item = item_store_get_item(filter->store, index);
+    gint score = match_query_score(filter->query, item->text, item->len);
+
+    item_store_set_visible(filter->store, index, score >= 0);
+    item_store_set_score(filter->store, index, score);
+}
+
+/** Sets visibility of items from \a from to \a to (excluding). */
+void filter_range(Filter *filter, guint from, guint to)
+{
+    ItemStore *store = filter->store;
+    guint i;
+
+    for ( i = from; i < to; ++i ) {
+        if ( filter->visible_only && !item_store_get_visible(store, i) )
+            continue;
+
+        filter_item(filter, i);
+    }
+}
+
+/** Sets visibility of candidates from \a from to \a to (excluding). */
+void filter_candidates(Filter *filter, guint from, guint to)
+{
+    const guint *candidates = (const guint *)filter->candidates->data;
+    guint i;
+
+    for ( i = from; i < to; ++i )
+        filter_item(filter, candidates[i]);
+}
+
+/**
+ * Queues \a count items (or candidates) of pass \a generation in chunks.
+ * Must be called with Filter::lock held if a worker thread can read
+ * progress of the pass.
+ */
+void filter_push(Filter *filter, guint count, guint generation)
+{
+    FilterTask *task;
+    guint i, chunks = (count + FILTER_CHUNK_SIZE - 1) / FILTER_CHUNK_SIZE;
+
+    g_byte_array_set_size(filter->done, chunks);
+    memset(filter->done->data, 0, chunks);
+    filter->progress = 0;
+
+    for ( i = 0; i < chunks; ++i ) {
+        task = g_slice_new0(FilterTask);
+        task->generation = generation;
+        task->chunk = i;
+        g_thread_pool_push(filter->pool, task, NULL);
+    }
+}
+
+/**
+ * Looks up candidates in worker thread and queues chunks unless the pass
+ * was cancelled. If index can't be used for the query, all items are
+ * matched as in #filter_start.
+ */
+void filter_lookup(FilterTask *task, Filter *filter)
+{
+    GArray *candidates = task->find(task->index, task->query);
+    guint count;
+
+    query_free(task->query);
+
+    g_mutex_lock(&filter->lock);
+    if (task->generation != filter->generation) {
+        g_mutex_unlock(&filter->lock);
+        if (candidates)
+            g_array_free(candidates, TRUE);
+        g_slice_free(FilterTask, task);
+        return;
+    }
+    ++filter->running;
+    g_mutex_unlock(&filter->lock);
+
+    if (candidates) {
+        item_store_set_all_visible(filter->store, FALSE);
+        filter->visible_only = FALSE;
+        filter->from = 0;
+        count = candidates->len;
+    } else {
+        count = filter->len - filter->from;
+    }
+
+    g_mutex_lock(&filter->lock);
+    filter->candidates = candidates;
+    filter->lookup = FALSE;
+    filter_push(filter, count, task->generation);
+    if (--filter->running == 0)
+        g_cond_signal(&filter->idle);
+    g_mutex_unlock(&filter->lock);
+
+    g_slice_free(FilterTask, task);
+}
+
+/** Processes chunk in worker thread unless its pass was cancelled. */
+void filter_chunk(FilterTask *task, Filter *filter)
+{
+    guint from, to;
+
+    if (task->find) {
+        filter_lookup(task, filter);
+        return;
+    }
+
+    g_mutex_lock(&filter->lock);
+    if (task->generation != filter->generation) {
+        g_mutex_unlock(&filter->lock);
+        g_slice_free(FilterTask, task);
+        return;
+    }
+    ++filter->running;
+    g_mutex_unlock(&filter->lock);
+
+    if (filter->candidates) {
+        from = task->chunk * FILTER_CHUNK_SIZE;
+        to = MIN(from + FILTER_CHUNK_SIZE, filter->candidates->len);
+        filter_candidates(filter, from, to);
+    } else {
+        from = filter->from + task->chunk * FILTER_CHUNK_SIZE;
+        to = MIN(from + FILTER_CHUNK_SIZE, filter->len);
+        filter_range(filter, from, to);
+    }
+
+    g_mutex_lock(&filter->lock);
+    filter->done->data[task->chunk] = 1;
+    if (--filter->running == 0)
+        g_cond_signal(&filter->idle);
+    g_mutex_unlock(&filter->lock);
+
+    g_slice_free(FilterTask, task);
+}
+
+/**
+ * Creates thread pool with \a threads workers.
+ * If \a threads is 0, number of processors is used.
+ */
+Filter *filter_new(guint threads)
+{
+    Filter *filter = g_new0(Filter, 1);
+
+    filter->threads = threads ? threads : g_get_num_processors();
+    filter->done = g_byte_array_new();
+    g_mutex_init(&filter->lock);
+    g_cond_init(&filter->idle);
+    filter->pool = g_thread_pool_new( (GFunc)filter_chunk, filter,
+                                      filter->threads, TRUE, NULL );
+
+    return filter;
+}
+
+/** Stops worker threads and frees \a filter. */
+void filter_free(Filter *filter)
+{
+    filter_cancel(filter);
+    g_thread_pool_free(filter->pool, TRUE, TRUE);
+    if (filter->candidates)
+        g_array_free(filter->candidates, TRUE);
+    g_byte_array_free(filter->done, TRUE);
+    g_mutex_clear(&filter->lock);
+    g_cond_clear(&filter->idle);
+    g_free(filter);
+}
+
+/**
+ * Starts new pass over \a store. Previous pass must be cancelled.
+ * Items before \a from are skipped.
+ * \returns generation of the pass
+ */
+guint filter_begin( Filter *filter,
+                    ItemStore *store,
+                    const Query *query,
+                    gboolean visible_only,
+                    guint from )
+{
+    guint generation;
+
+    filter->store = store;
+    filter->query = query;
+    filter->len = item_store_get_length(store);
+    filter->visible_only = visible_only;
+    filter->from = MIN(from, filter->len);
+
+    g_mutex_lock(&filter->lock);
+    generation = ++filter->generation;
+    filter->lookup = FALSE;
+    g_mutex_unlock(&filter->lock);
+
+    return generation;
+}
+
+/** Cancels current pass and frees its candidates. */
+void filter_reset(Filter *filter)
+{
+    filter_cancel(filter);
+
+    if (filter->candidates) {
+        g_array_free(filter->candidates, TRUE);
+        filter->candidates = NULL;
+    }
+}
+
+/**
+ * Starts setting visibility of items in \a store according to \a query.
+ * Items before \a from are skipped.
+ * If \a visible_only is TRUE, hidden items are not matched.
+ * Pass which is still running is cancelled (see #filter_cancel).
+ */
+void filter_start( Filter *filter,
+                   ItemStore *store,
+                   const Query *query,
+                   gboolean visible_only,
+                   guint from )
+{
+    guint generation;
+
+    filter_reset(filter);
+
+    generation = filter_begin(filter, store, query, visible_only, from);
+    filter_push(filter, filter->len - filter->from, generation);
+}
+
+/**
+ * Starts setting visibility of items in \a store according to \a query
+ * like #filter_start but only candidates found by \a find in \a index
+ * are matched and other items are hidden.
+ * Candidates are looked up in worker thread; if \a find returns NULL,
+ * items are matched as in #filter_start with \a visible_only and \a from.
+ * Pass which is still running is cancelled (see #filter_cancel).
+ */
+void filter_start_candidates( Filter *filter,
+                              ItemStore *store,
+                              const Query *query,
+                              gboolean visible_only,
+                              guint from,
+                              FilterFindFunc find,
+                              gpointer index )
+{
+    FilterTask *task;
+
+    filter_reset(filter);
+
+    g_byte_array_set_size(filter->done, 0);
+    filter->progress = 0;
+
+    task = g_slice_new0(FilterTask);
+    task->generation = filter_begin(filter, store, query, visible_only, from);
+    task->find = find;
+    task->index = index;
+    task->query = query_new(query->needle);
+
+    g_mutex_lock(&filter->lock);
+    filter->lookup = TRUE;
+    g_mutex_unlock(&filter->lock);
+
+    g_thread_pool_push(filter->pool, task, NULL);
+}
+
+/**
+ * Cancels current pass.
+ * Returns after chunks which are being processed are finished; items in
+ * other unprocessed chunks keep their visibility.
+ */
+void filter_cancel(Filter *filter)
+{
+    g_mutex_lock(&filter->lock);
+    ++filter->generation;
+    while (filter->running > 0)
+        g_cond_wait(&filter->idle, &filter->lock);
+    g_mutex_unlock(&filter->lock);
+}
+
+/**
+ * Returns number of items (from the first one) already filtered
+ * in current pass.
+ */
+guint filter_get_progress(Filter *filter)
+{
+    guint done, progress;
+
+    g_mutex_lock(&filter->lock);
+    while ( filter->progress < filter->done->len &&
+            filter->done->data[filter->progress] )
+        ++filter->progress;
+
+    done = filter->progress * FILTER_CHUNK_SIZE;
+
+    if (filter->lookup) {
+        progress = 0;
+    } else if (filter->candidates) {
+        /* items before next unprocessed candidate are final */
+        progress = done < filter->candidates->len
+            ? g_array_index(filter->candidates, guint, done)
+            : filter->len;
+    } else {
+        progress = MIN(filter->from + done, filter->len);
+    }
+    g_mutex_unlock(&filter->lock);
+
+    return progress;
+}
+
+/** Returns number of threads used for filtering. */
+guint filter_get_threads(const Filter *filter)
+{
+    return filter->threads;
+}
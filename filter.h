@@ -0,0 +1,42 @@
+/**
+ * \file filter.h
+ *
+ * Evaluating visibility of items in thread pool.
+ */
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "item_store.h"
+#include "match.h"
+
+#include <glib.h>
+
+/** thread pool for filtering items */
+typedef struct _Filter Filter;
+
+/**
+ * Finds items which can match \a query in \a index.
+ * \returns new array of ascending item indexes or NULL if the index can't
+ * be used for the query (see #trigram_index_find)
+ */
+typedef GArray *(*FilterFindFunc)(gpointer index, const Query *query);
+
+Filter *filter_new(guint threads);
+void filter_free(Filter *filter);
+void filter_start( Filter *filter,
+                   ItemStore *store,
+                   const Query *query,
+                   gboolean visible_only,
+                   guint from );
+void filter_start_candidates( Filter *filter,
+                              ItemStore *store,
+                              const Query *query,
+                              gboolean visible_only,
+                              guint from,
+                              FilterFindFunc find,
+                              gpointer index );
+void filter_cancel(Filter *filter);
+guint filter_get_progress(Filter *filter);
+guint filter_get_threads(const Filter *filter);
+
+#endif /* FILTER_H */
@@ -0,0 +1,693 @@
+/**
+ * \file fm_index.c
+ *
+ * Compressed full-text index of case-folded items.
+ *
+ * Items folded to lower case are concatenated to a single text, each
+ * preceded by a separator and the text is terminated by a sentinel. Bytes
+ * are renumbered so only bytes which occur in items take part in the
+ * alphabet. Suffix array of the text is built with SA-IS algorithm
+ * (linear time) and is used to compute Burrows-Wheeler transform (BWT) of
+ * the text; the suffix array is dropped afterwards.
+ *
+ * BWT is stored in a wavelet matrix: one bit vector for each bit of symbol
+ * with a rank directory (count of ones before every 512 bits), so the index
+ * takes about (bits per symbol) * 1.07 bits per byte of items. Number of
+ * occurrences of a token (#fm_index_count) is found by backward search in
+ * time proportional to token length, independent of number of items.
+ *
+ * To find items containing a token, each occurrence is followed backwards
+ * (LF-mapping) to the separator in front of the item; rank of the separator
+ * gives item index (FmIndex::separators). Item index is also stored for
+ * every #FM_SAMPLE_RATE-th position of text (FmIndex::samples, marked in
+ * FmIndex::sampled in BWT order), so a walk stops after at most
+ * #FM_SAMPLE_RATE steps even in long items. This takes time proportional to
+ * number of occurrences, so #fm_index_find uses the least frequent token of
+ * query and gives up if it occurs too often (scanning items is then faster).
+ *
+ * Items must not change after the index is created.
+ */
+#include "fm_index.h"
+
+#include <string.h>
+
+/** symbol terminating the text */
+#define FM_SENTINEL 0
+/** symbol in front of each item */
+#define FM_SEPARATOR 1
+
+/**
+ * number of 64-bit words in a block of bit vector (bits followed by count
+ * of ones before the block; block fills single cache line)
+ */
+#define FM_BLOCK_WORDS 8
+/** number of bits in a block (last 32 bits hold the count) */
+#define FM_BLOCK_BITS (FM_BLOCK_WORDS * 64 - 32)
+
+/** item index is stored for every N-th position of text */
+#define FM_SAMPLE_RATE 32
+
+/**
+ * Items are located only if the least frequent token occurs at most this
+ * many times (locating single occurrence costs about as much as matching
+ * hundreds of items).
+ */
+#define FM_MAX_OCCURRENCES(items) ((items) / 256 + 64)
+
+/** bit vector with rank support (blocks of #FM_BLOCK_WORDS words) */
+typedef struct {
+    guint64 *blocks;
+} FmBits;
+
+struct _FmIndex {
+    /** items (#Item, owned by store) */
+    const Item *items;
+    /** number of items */
+    guint len;
+
+    /** symbol for each byte (folded to lower case, 0 if not in items) */
+    guint8 symbols[256];
+    /** number of symbols (including sentinel and separator) */
+    guint alphabet;
+    /** number of bits per symbol */
+    guint bits;
+    /** length of text */
+    guint32 n;
+
+    /** wavelet matrix levels (most significant bit first) */
+    FmBits *levels;
+    /** number of zeros in each level */
+    guint32 *zeros;
+    /** position of first occurrence of each symbol after the last level */
+    guint32 *starts;
+    /** number of symbols smaller than each symbol in text */
+    guint32 *counts;
+    /** item index for each separator in BWT order */
+    guint32 *separators;
+    /** BWT positions of suffixes starting at sampled text positions */
+    FmBits sampled;
+    /** item index for each sampled position in BWT order */
+    guint32 *samples;
+
+    /** Index is built (set by build thread). */
+    gint ready;
+    /** build thread */
+    GThread *thread;
+    /** time (in microseconds) needed to build the index */
+    gint64 build_time;
+};
+
+/** Returns number of ones in \a word. */
+guint fm_popcount(guint64 word)
+{
+#if defined(__POPCNT__)
+    return __builtin_popcountll(word);
+#else
+    word = word - ((word >> 1) & 0x5555555555555555ULL);
+    word = (word & 0x3333333333333333ULL) +
+           ((word >> 2) & 0x3333333333333333ULL);
+    word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (word * 0x0101010101010101ULL) >> 56;
+#endif
+}
+
+/**
+ * Returns bit \a i of \a bits and sets \a rank to number of ones before
+ * the bit.
+ */
+guint fm_bits_get(const FmBits *bits, guint32 i, guint32 *rank)
+{
+    const guint64 *block = bits->blocks + i / FM_BLOCK_BITS * FM_BLOCK_WORDS;
+    guint32 bit = i % FM_BLOCK_BITS, w;
+    guint32 r = block[FM_BLOCK_WORDS - 1] >> 32;
+
+    for ( w = 0; w < bit / 64; ++w )
+        r += fm_popcount(block[w]);
+    /* bits before i in its word */
+    if (bit % 64)
+        r += fm_popcount( block[w] << (64 - bit % 64) );
+    *rank = r;
+
+    return (block[w] >> (bit % 64)) & 1;
+}
+
+/** Returns number of ones before position \a i in \a bits. */
+guint32 fm_bits_rank1(const FmBits *bits, guint32 i)
+{
+    guint32 rank;
+
+    fm_bits_get(bits, i, &rank);
+
+    return rank;
+}
+
+/**
+ * Initializes \a bits from bit \a bit of \a n \a symbols.
+ * \returns number of zeros
+ */
+guint32 fm_bits_init( FmBits *bits,
+                      const guint8 *symbols,
+                      guint32 n,
+                      guint bit )
+{
+    guint32 i, offset, blocks = n / FM_BLOCK_BITS + 1, rank = 0;
+    guint64 *block;
+    guint w;
+
+    bits->blocks = g_new0(guint64, blocks * FM_BLOCK_WORDS);
+
+    for ( i = 0; i < n; ++i ) {
+        if ( (symbols[i] >> bit) & 1 ) {
+            block = bits->blocks + i / FM_BLOCK_BITS * FM_BLOCK_WORDS;
+            offset = i % FM_BLOCK_BITS;
+            block[offset / 64] |= (guint64)1 << (offset % 64);
+        }
+    }
+
+    for ( i = 0; i < blocks; ++i ) {
+        /* count is stored in unused half of the last word */
+        block = bits->blocks + i * FM_BLOCK_WORDS;
+        block[FM_BLOCK_WORDS - 1] |= (guint64)rank << 32;
+        for ( w = 0; w < FM_BLOCK_WORDS - 1; ++w )
+            rank += fm_popcount(block[w]);
+        rank += fm_popcount( block[w] & 0xffffffff );
+    }
+
+    return n - rank;
+}
+
+/**\{ \name SA-IS suffix array construction */
+
+/** Returns symbol \a i of text \a s (bytes or integers if \a wide). */
+#define SAIS_CHR(i) ( wide ? ((const gint32 *)s)[i] : ((const guint8 *)s)[i] )
+/** Returns TRUE if suffix \a i is S-type. */
+#define SAIS_TGET(i) ( (t[(i) / 8] >> ((i) % 8)) & 1 )
+/** Sets type of suffix \a i. */
+#define SAIS_TSET(i, b) \
+    ( t[(i) / 8] = (b) ? (t[(i) / 8] | (1 << ((i) % 8))) \
+                       : (t[(i) / 8] & ~(1 << ((i) % 8))) )
+/** Returns TRUE if suffix \a i is leftmost S-type. */
+#define SAIS_LMS(i) ( (i) > 0 && SAIS_TGET(i) && !SAIS_TGET((i) - 1) )
+
+/** Computes start (or end if \a end is TRUE) of each symbol bucket. */
+void sais_buckets( const void *s,
+                   gboolean wide,
+                   gint32 *buckets,
+                   gint32 n,
+                   gint32 k,
+                   gboolean end )
+{
+    gint32 i, sum = 0;
+
+    memset( buckets, 0, (k + 1) * sizeof(gint32) );
+    for ( i = 0; i < n; ++i )
+        ++buckets[SAIS_CHR(i)];
+    for ( i = 0; i <= k; ++i ) {
+        sum += buckets[i];
+        buckets[i] = end ? sum : sum - buckets[i];
+    }
+}
+
+/** Induces order of L-type and then S-type suffixes. */
+void sais_induce( const guint8 *t,
+                  gint32 *sa,
+                  const void *s,
+                  gboolean wide,
+                  gint32 *buckets,
+                  gint32 n,
+                  gint32 k )
+{
+    gint32 i, j;
+
+    sais_buckets(s, wide, buckets, n, k, FALSE);
+    for ( i = 0; i < n; ++i ) {
+        j = sa[i] - 1;
+        if ( j >= 0 && !SAIS_TGET(j) )
+            sa[buckets[SAIS_CHR(j)]++] = j;
+    }
+
+    sais_buckets(s, wide, buckets, n, k, TRUE);
+    for ( i = n - 1; i >= 0; --i ) {
+        j = sa[i] - 1;
+        if ( j >= 0 && SAIS_TGET(j) )
+            sa[--buckets[SAIS_CHR(j)]] = j;
+    }
+}
+
+/**
+ * Builds suffix array \a sa of text \a s of length \a n with symbols
+ * from 0 to \a k. Last symbol must be unique and smallest.
+ */
+void sais( const void *s, gint32 *sa, gint32 n, gint32 k, gboolean wide )
+{
+    guint8 *t = g_new0(guint8, n / 8 + 1);
+    gint32 *buckets = g_new(gint32, k + 1);
+    gint32 *s1, i, j, d, n1 = 0, name = 0, prev = -1, pos;
+    gboolean diff;
+
+    /* classify suffixes (S-type is 1) */
+    SAIS_TSET(n - 2, 0);
+    SAIS_TSET(n - 1, 1);
+    for ( i = n - 3; i >= 0; --i ) {
+        SAIS_TSET( i, SAIS_CHR(i) < SAIS_CHR(i + 1) ||
+                      (SAIS_CHR(i) == SAIS_CHR(i + 1) && SAIS_TGET(i + 1)) );
+    }
+
+    /* sort LMS substrings */
+    sais_buckets(s, wide, buckets, n, k, TRUE);
+    for ( i = 0; i < n; ++i )
+        sa[i] = -1;
+    for ( i = 1; i < n; ++i ) {
+        if ( SAIS_LMS(i) )
+            sa[--buckets[SAIS_CHR(i)]] = i;
+    }
+    sais_induce(t, sa, s, wide, buckets, n, k);
+
+    /* name LMS substrings */
+    for ( i = 0; i < n; ++i ) {
+        if ( SAIS_LMS(sa[i]) )
+            sa[n1++] = sa[i];
+    }
+    for ( i = n1; i < n; ++i )
+        sa[i] = -1;
+    for ( i = 0; i < n1; ++i ) {
+        pos = sa[i];
+        diff = FALSE;
+        for ( d = 0; d < n; ++d ) {
+            if ( prev == -1 || SAIS_CHR(pos + d) != SAIS_CHR(prev + d) ||
+                 SAIS_TGET(pos + d) != SAIS_TGET(prev + d) )
+            {
+                diff = TRUE;
+                break;
+            }
+            if ( d > 0 && (SAIS_LMS(pos + d) || SAIS_LMS(prev + d)) )
+                break;
+        }
+        if (diff) {
+            ++name;
+            prev = pos;
+        }
+        sa[n1 + pos / 2] = name - 1;
+    }
+    for ( i = n - 1, j = n - 1; i >= n1; --i ) {
+        if (sa[i] >= 0)
+            sa[j--] = sa[i];
+    }
+
+    /* sort LMS suffixes (recursively if names are not unique) */
+    s1 = sa + n - n1;
+    if (name < n1) {
+        sais(s1, sa, n1, name - 1, TRUE);
+    } else {
+        for ( i = 0; i < n1; ++i )
+            sa[s1[i]] = i;
+    }
+
+    /* induce order of all suffixes from sorted LMS suffixes */
+    sais_buckets(s, wide, buckets, n, k, TRUE);
+    for ( i = 1, j = 0; i < n; ++i ) {
+        if ( SAIS_LMS(i) )
+            s1[j++] = i;
+    }
+    for ( i = 0; i < n1; ++i )
+        sa[i] = s1[sa[i]];
+    for ( i = n1; i < n; ++i )
+        sa[i] = -1;
+    for ( i = n1 - 1; i >= 0; --i ) {
+        j = sa[i];
+        sa[i] = -1;
+        sa[--buckets[SAIS_CHR(j)]] = j;
+    }
+    sais_induce(t, sa, s, wide, buckets, n, k);
+
+    g_free(buckets);
+    g_free(t);
+}
+
+/**\}*/
+
+/** Returns number of symbols \a c before position \a i in BWT. */
+guint32 fm_rank(const FmIndex *index, guint c, guint32 i)
+{
+    const FmBits *bits;
+    guint level, b;
+
+    for ( level = 0; level < index->bits; ++level ) {
+        bits = &index->levels[level];
+        b = (c >> (index->bits - level - 1)) & 1;
+        i = b ? index->zeros[level] + fm_bits_rank1(bits, i)
+              : i - fm_bits_rank1(bits, i);
+    }
+
+    return i - index->starts[c];
+}
+
+/**
+ * Returns index of item containing text position \a pos
+ * (G_MAXUINT32 if \a pos is before the first item).
+ */
+guint32 fm_find_item( const FmIndex *index,
+                      const guint32 *item_starts,
+                      guint32 pos )
+{
+    guint32 from = 0, to = index->len, mid;
+
+    while (from < to) {
+        mid = from + (to - from) / 2;
+        if (item_starts[mid] <= pos)
+            from = mid + 1;
+        else
+            to = mid;
+    }
+
+    return from > 0 ? from - 1 : G_MAXUINT32;
+}
+
+/** Builds index in background thread. */
+gpointer fm_index_build(FmIndex *index)
+{
+    gint64 start = g_get_monotonic_time();
+    const Item *item;
+    guint8 *text, *bwt, *next, *swap;
+    gint32 *sa;
+    guint32 *item_starts, i, j, k, pos, n = 1, zero, one;
+    guint c, level;
+    gsize total = 1;
+
+    if (index->len == 0) {
+        g_atomic_int_set(&index->ready, TRUE);
+        return NULL;
+    }
+
+    /* alphabet of folded bytes */
+    for ( i = 0; i < index->len; ++i ) {
+        item = &index->items[i];
+        for ( j = 0; j < item->len; ++j )
+            index->symbols[(guint8)g_ascii_tolower(item->text[j])] = 1;
+        total += item->len + 1;
+    }
+
+    if ( total >= G_MAXINT32 ) {
+        g_atomic_int_set(&index->ready, TRUE);
+        return NULL;
+    }
+
+    index->alphabet = FM_SEPARATOR + 1;
+    for ( c = 0; c < 256; ++c ) {
+        if (index->symbols[c])
+            index->symbols[c] = index->alphabet++;
+    }
+    for ( index->bits = 1; (1u << index->bits) < index->alphabet;
+          ++index->bits );
+
+    /* text: separator before each item and sentinel at the end */
+    index->n = total;
+    text = g_malloc(index->n);
+    item_starts = g_new(guint32, index->len + 1);
+    pos = 0;
+    for ( i = 0; i < index->len; ++i ) {
+        item = &index->items[i];
+        text[pos++] = FM_SEPARATOR;
+        item_starts[i] = pos;
+        for ( j = 0; j < item->len; ++j ) {
+            text[pos++] =
+                index->symbols[(guint8)g_ascii_tolower(item->text[j])];
+        }
+    }
+    text[pos] = FM_SENTINEL;
+    item_starts[index->len] = index->n;
+    n = index->n;
+
+    sa = g_new(gint32, n);
+    sais(text, sa, n, index->alphabet - 1, FALSE);
+
+    /* BWT and item index for each separator and sample in BWT order */
+    bwt = g_malloc(n);
+    next = g_malloc(n);
+    index->separators = g_new(guint32, index->len + 1);
+    index->samples = g_new(guint32, n / FM_SAMPLE_RATE + 1);
+    index->counts = g_new0(guint32, index->alphabet + 1);
+    for ( i = 0, j = 0, k = 0; i < n; ++i ) {
+        bwt[i] = sa[i] > 0 ? text[sa[i] - 1] : text[n - 1];
+        ++index->counts[bwt[i] + 1];
+        if (bwt[i] == FM_SEPARATOR) {
+            /* item starting at sa[i] */
+            pos = fm_find_item(index, item_starts, sa[i]);
+            index->separators[j++] =
+                pos < index->len && item_starts[pos] == (guint32)sa[i]
+                ? pos : G_MAXUINT32;
+        }
+        next[i] = sa[i] % FM_SAMPLE_RATE == 0;
+        if (next[i])
+            index->samples[k++] = fm_find_item(index, item_starts, sa[i]);
+    }
+    fm_bits_init(&index->sampled, next, n, 0);
+    for ( c = 1; c <= index->alphabet; ++c )
+        index->counts[c] += index->counts[c - 1];
+    g_free(sa);
+    g_free(text);
+    g_free(item_starts);
+
+    /* wavelet matrix */
+    index->levels = g_new(FmBits, index->bits);
+    index->zeros = g_new(guint32, index->bits);
+    for ( level = 0; level < index->bits; ++level ) {
+        c = index->bits - level - 1;
+        index->zeros[level] = fm_bits_init(&index->levels[level], bwt, n, c);
+
+        /* stable partition by the bit */
+        zero = 0;
+        one = index->zeros[level];
+        for ( i = 0; i < n; ++i ) {
+            if ( (bwt[i] >> c) & 1 )
+                next[one++] = bwt[i];
+            else
+                next[zero++] = bwt[i];
+        }
+        swap = bwt;
+        bwt = next;
+        next = swap;
+    }
+
+    index->starts = g_new0(guint32, 1 << index->bits);
+    for ( i = n; i > 0; --i )
+        index->starts[bwt[i - 1]] = i - 1;
+    g_free(bwt);
+    g_free(next);
+
+    index->build_time = g_get_monotonic_time() - start;
+    g_atomic_int_set(&index->ready, TRUE);
+
+    return NULL;
+}
+
+/**
+ * Starts building index of items in \a store in background thread.
+ * Items must not be added to \a store afterwards.
+ */
+FmIndex *fm_index_new(const ItemStore *store)
+{
+    FmIndex *index = g_new0(FmIndex, 1);
+
+    index->len = item_store_get_length(store);
+    index->items = index->len ? item_store_get_item(store, 0) : NULL;
+    index->thread = g_thread_new( "fm-index",
+                                  (GThreadFunc)fm_index_build, index );
+
+    return index;
+}
+
+/** Waits for build thread and frees \a index. */
+void fm_index_free(FmIndex *index)
+{
+    guint level;
+
+    g_thread_join(index->thread);
+
+    for ( level = 0; index->levels && level < index->bits; ++level )
+        g_free(index->levels[level].blocks);
+    g_free(index->levels);
+    g_free(index->zeros);
+    g_free(index->starts);
+    g_free(index->counts);
+    g_free(index->separators);
+    g_free(index->sampled.blocks);
+    g_free(index->samples);
+    g_free(index);
+}
+
+/** Returns TRUE if index is built and can be used. */
+gboolean fm_index_is_ready(FmIndex *index)
+{
+    return g_atomic_int_get(&index->ready) && index->levels;
+}
+
+/**
+ * Finds BWT range of suffixes starting with \a pattern (case insensitive).
+ * \returns number of occurrences of \a pattern in items
+ */
+guint32 fm_index_range( FmIndex *index,
+                        const gchar *pattern,
+                        gsize len,
+                        guint32 *from,
+                        guint32 *to )
+{
+    guint c;
+
+    *from = 0;
+    *to = index->n;
+    while ( len > 0 && *from < *to ) {
+        c = index->symbols[(guint8)g_ascii_tolower(pattern[--len])];
+        if (!c)
+            return 0;
+        *from = index->counts[c] + fm_rank(index, c, *from);
+        *to = index->counts[c] + fm_rank(index, c, *to);
+    }
+
+    return *to > *from ? *to - *from : 0;
+}
+
+/** Returns number of occurrences of \a pattern in items. */
+guint fm_index_count(FmIndex *index, const gchar *pattern, gsize len)
+{
+    guint32 from, to;
+
+    return fm_index_range(index, pattern, len, &from, &to);
+}
+
+/**
+ * Replaces BWT positions of \a count suffixes in \a rows with indexes of
+ * items containing the suffixes.
+ *
+ * Each suffix is followed backwards (LF-mapping) to separator in front of
+ * its item or to sampled position, so each walk takes at most
+ * #FM_SAMPLE_RATE steps. The walks advance together one level of wavelet
+ * matrix at a time so cache misses of independent walks overlap.
+ */
+void fm_index_locate(const FmIndex *index, guint32 *rows, guint count)
+{
+    guint32 *positions = g_new(guint32, count), rank;
+    guint8 *symbols = g_new(guint8, count);
+    const FmBits *bits;
+    guint i, level, b, c, active = count;
+
+    while (active > 0) {
+        for ( i = 0; i < active; ) {
+            if ( fm_bits_get(&index->sampled, rows[i], &rank) ) {
+                /* move finished walk after active ones */
+                --active;
+                rows[i] = rows[active];
+                rows[active] = index->samples[rank];
+            } else {
+                positions[i] = rows[i];
+                symbols[i] = 0;
+                ++i;
+            }
+        }
+
+        for ( level = 0; level < index->bits; ++level ) {
+            bits = &index->levels[level];
+            for ( i = 0; i < active; ++i ) {
+                b = fm_bits_get(bits, positions[i], &rank);
+                positions[i] = b ? index->zeros[level] + rank
+                                 : positions[i] - rank;
+                symbols[i] = symbols[i] << 1 | b;
+            }
+        }
+
+        for ( i = 0; i < active; ) {
+            c = symbols[i];
+            /* rank of symbol before original position */
+            rank = positions[i] - index->starts[c];
+            if (c == FM_SEPARATOR) {
+                /* move finished walk after active ones */
+                --active;
+                rows[i] = rows[active];
+                positions[i] = positions[active];
+                symbols[i] = symbols[active];
+                rows[active] = index->separators[rank];
+            } else {
+                rows[i++] = index->counts[c] + rank;
+            }
+        }
+    }
+
+    g_free(positions);
+    g_free(symbols);
+}
+
+/** Compares item indexes. */
+gint fm_compare_items(gconstpointer a, gconstpointer b)
+{
+    guint x = *(const guint *)a, y = *(const guint *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Finds items which can match \a query.
+ * \returns new array of ascending item indexes (candidates which have to be
+ * verified with #match_query) or NULL if the index can't be used (query has
+ * no non-empty token or all tokens occur too often)
+ */
+GArray *fm_index_find(FmIndex *index, const Query *query)
+{
+    const QueryToken *token;
+    GArray *candidates;
+    guint32 from, to, best_from = 0, best_to = 0, count, i;
+    guint *items, n;
+    gboolean found = FALSE;
+
+    for ( i = 0; i < query->tokens->len; ++i ) {
+        token = &g_array_index(query->tokens, QueryToken, i);
+        if (!token->len)
+            continue;
+
+        count = fm_index_range(index, token->text, token->len, &from, &to);
+        if ( !found || count < best_to - best_from ) {
+            found = TRUE;
+            best_from = from;
+            best_to = from + count;
+        }
+    }
+
+    if ( !found || best_to - best_from > FM_MAX_OCCURRENCES(index->len) )
+        return NULL;
+
+    candidates = g_array_sized_new( FALSE, FALSE, sizeof(guint),
+                                    best_to - best_from );
+    g_array_set_size(candidates, best_to - best_from);
+    items = (guint *)candidates->data;
+
+    for ( i = best_from; i < best_to; ++i )
+        items[i - best_from] = i;
+    fm_index_locate(index, items, candidates->len);
+
+    g_array_sort(candidates, fm_compare_items);
+
+    /* remove duplicates */
+    for ( i = 0, n = 0; i < candidates->len; ++i ) {
+        if ( n == 0 || items[n - 1] != items[i] )
+            items[n++] = items[i];
+    }
+    g_array_set_size(candidates, n);
+
+    return candidates;
+}
+
+/** Returns memory used by index in bytes. */
+gsize fm_index_get_size(FmIndex *index)
+{
+    gsize blocks = index->n / FM_BLOCK_BITS + 1;
+
+    return index->bits * blocks * FM_BLOCK_WORDS * sizeof(guint64)
+        + blocks * FM_BLOCK_WORDS * sizeof(guint64)
+        + (index->len + 1 + index->n / FM_SAMPLE_RATE + 1) * sizeof(guint32)
+        + ((1 << index->bits) + index->alphabet + 1) * sizeof(guint32);
+}
+
+/** Returns time (in microseconds) needed to build the index. */
+gint64 fm_index_get_build_time(FmIndex *index)
+{
+    return index->build_time;
+}
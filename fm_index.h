@@ -0,0 +1,26 @@
+/**
+ * \file fm_index.h
+ *
+ * Compressed full-text index of case-folded items.
+ */
+#ifndef FM_INDEX_H
+#define FM_INDEX_H
+
+#include "item_store.h"
+#include "match.h"
+
+#include <glib.h>
+
+/** FM-index built in background thread */
+typedef struct _FmIndex FmIndex;
+
+FmIndex *fm_index_new(const ItemStore *store);
+void fm_index_free(FmIndex *index);
+gboolean fm_index_is_ready(FmIndex *index);
+guint fm_index_count(FmIndex *index, const gchar *pattern, gsize len);
+GArray *fm_index_find(FmIndex *index, const Query *query);
+
+gsize fm_index_get_size(FmIndex *index);
+gint64 fm_index_get_build_time(FmIndex *index);
+
+#endif /* FM_INDEX_H */
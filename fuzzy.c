@@ -0,0 +1,369 @@
+/**
+ * \file fuzzy.c
+ *
+ * Fuzzy matching and scoring of filter tokens.
+ *
+ * Pattern matches text if all its bytes are found in text in the same order
+ * (case insensitive). Score of a match rewards matched bytes at start of
+ * words (after white space, path separator or other non-word character and
+ * at camelCase or letter-digit transitions) and consecutive runs of matched
+ * bytes, and penalizes gaps between matched bytes. Constants are the same
+ * as in fzf so results are ranked similarly.
+ *
+ * #fuzzy_find only checks if text matches (without scoring).
+ *
+ * #fuzzy_match first checks cheaply if text contains pattern as subsequence
+ * (each byte is searched with vectorized #find_caseless), which gives the
+ * first possible position of each pattern byte. Matching the pattern
+ * backwards from the end of text gives the last possible positions. The best
+ * alignment is computed by dynamic programming only between these bounds.
+ * If the matrix would be too large (more than #FUZZY_MAX_CELLS cells or
+ * pattern longer than #FUZZY_MAX_PATTERN), the shortest match ending at the
+ * greedy match is scored instead.
+ *
+ * Functions in this file don't use GTK and can be called from any thread.
+ */
+#include "fuzzy.h"
+#include "scan.h"
+
+#include <string.h>
+
+/**\{ \name Scores */
+#define SCORE_MATCH 16
+#define SCORE_GAP_START -3
+#define SCORE_GAP_EXTENSION -1
+/** bonus for matching at word boundary */
+#define BONUS_BOUNDARY (SCORE_MATCH / 2)
+/** bonus for matching non-word character */
+#define BONUS_NON_WORD (SCORE_MATCH / 2)
+/** bonus for matching after white space */
+#define BONUS_BOUNDARY_WHITE (BONUS_BOUNDARY + 2)
+/** bonus for matching after path separator or other delimiter */
+#define BONUS_BOUNDARY_DELIMITER (BONUS_BOUNDARY + 1)
+/** bonus for matching at camelCase or letter-digit transition */
+#define BONUS_CAMEL (BONUS_BOUNDARY + SCORE_GAP_EXTENSION)
+/** minimal bonus for consecutive match (offsets starting a gap) */
+#define BONUS_CONSECUTIVE (-(SCORE_GAP_START + SCORE_GAP_EXTENSION))
+/** bonus of the first pattern byte is multiplied */
+#define BONUS_FIRST_MULTIPLIER 2
+/**\}*/
+
+/** maximum size of dynamic programming matrix (pattern times text bytes) */
+#define FUZZY_MAX_CELLS 8192
+/** maximum pattern length scored with dynamic programming */
+#define FUZZY_MAX_PATTERN 64
+
+/** character classes (order matters, see #fuzzy_bonus) */
+typedef enum {
+    CLASS_WHITE,
+    CLASS_NON_WORD,
+    CLASS_DELIMITER,
+    CLASS_LOWER,
+    CLASS_UPPER,
+    CLASS_NUMBER
+} CharClass;
+
+/** Returns class of byte \a c. */
+CharClass fuzzy_class(gchar c)
+{
+    if ( g_ascii_islower(c) )
+        return CLASS_LOWER;
+    if ( g_ascii_isupper(c) )
+        return CLASS_UPPER;
+    if ( g_ascii_isdigit(c) )
+        return CLASS_NUMBER;
+    if ( g_ascii_isspace(c) )
+        return CLASS_WHITE;
+    if ( c == '/' || c == ',' || c == ':' || c == ';' || c == '|' ||
+         c == '\\' )
+        return CLASS_DELIMITER;
+    /* bytes of UTF-8 sequences are treated as letters */
+    if ( (guchar)c >= 0x80 )
+        return CLASS_LOWER;
+    return CLASS_NON_WORD;
+}
+
+/** Returns bonus for matching byte of class \a cls after class \a prev. */
+gint fuzzy_bonus(CharClass prev, CharClass cls)
+{
+    if (cls > CLASS_DELIMITER) {
+        if (prev == CLASS_WHITE)
+            return BONUS_BOUNDARY_WHITE;
+        if (prev == CLASS_DELIMITER)
+            return BONUS_BOUNDARY_DELIMITER;
+        if (prev == CLASS_NON_WORD)
+            return BONUS_BOUNDARY;
+    }
+
+    if ( (prev == CLASS_LOWER && cls == CLASS_UPPER) ||
+         (prev != CLASS_NUMBER && cls == CLASS_NUMBER) )
+        return BONUS_CAMEL;
+
+    if (cls == CLASS_WHITE)
+        return BONUS_BOUNDARY_WHITE;
+    if (cls == CLASS_NON_WORD || cls == CLASS_DELIMITER)
+        return BONUS_NON_WORD;
+
+    return 0;
+}
+
+/** Returns bonus for matching byte \a i of \a text. */
+gint fuzzy_bonus_at(const gchar *text, gsize i)
+{
+    return fuzzy_bonus( i ? fuzzy_class(text[i - 1]) : CLASS_WHITE,
+                        fuzzy_class(text[i]) );
+}
+
+/**
+ * buffer of each thread for matrices of #fuzzy_score_range which don't fit
+ * on stack (gint; grows as needed and is reused for following items)
+ */
+static GPrivate fuzzy_scratch =
+    G_PRIVATE_INIT( (GDestroyNotify)g_array_unref );
+
+/**
+ * Scores the best match of \a pattern in \a text using dynamic programming.
+ * Byte \c i of pattern can be matched only from \a firsts[i] to
+ * \a lasts[i] (its first and last possible position in text).
+ */
+gint fuzzy_score_range( const gchar *pattern,
+                        gsize m,
+                        const gchar *text,
+                        const gsize *firsts,
+                        const gsize *lasts )
+{
+    /* scores with pattern byte i matched at j (M) or before j (H) */
+    gint *buffer, *m_prev, *m_cur, *h_prev, *h_cur, *c_prev, *c_cur, *swap;
+    gint *bonus;
+    gint stack[7 * 256];
+    GArray *scratch;
+    gint from = firsts[0], n = lasts[m - 1] + 1 - from;
+    gint i, j, to, b, fb, c, gap, best = 0;
+    CharClass prev, cls;
+    const gint none = G_MININT / 2;
+
+    if ( 7 * n <= (gint)G_N_ELEMENTS(stack) ) {
+        buffer = stack;
+    } else {
+        scratch = g_private_get(&fuzzy_scratch);
+        if (!scratch) {
+            scratch = g_array_new( FALSE, FALSE, sizeof(gint) );
+            g_private_set(&fuzzy_scratch, scratch);
+        }
+        if ( scratch->len < (guint)(7 * n) )
+            g_array_set_size(scratch, 7 * n);
+        buffer = (gint *)scratch->data;
+    }
+    m_prev = buffer;
+    m_cur = m_prev + n;
+    h_prev = m_cur + n;
+    h_cur = h_prev + n;
+    c_prev = h_cur + n;
+    c_cur = c_prev + n;
+    bonus = c_cur + n;
+
+    prev = from ? fuzzy_class(text[from - 1]) : CLASS_WHITE;
+    for ( j = 0; j < n; ++j ) {
+        cls = fuzzy_class(text[from + j]);
+        bonus[j] = fuzzy_bonus(prev, cls);
+        prev = cls;
+    }
+
+    for ( i = 0; i < (gint)m; ++i ) {
+        /* next row reads this row up to before last position of next byte */
+        to = (i + 1 < (gint)m ? lasts[i + 1] : lasts[i] + 1) - from;
+        for ( j = firsts[i] - from; j < to; ++j ) {
+            m_cur[j] = none;
+            c_cur[j] = 0;
+
+            if ( j <= (gint)lasts[i] - from &&
+                 g_ascii_tolower(text[from + j]) == pattern[i] )
+            {
+                if (i == 0) {
+                    m_cur[j] = SCORE_MATCH + bonus[j] * BONUS_FIRST_MULTIPLIER;
+                    c_cur[j] = 1;
+                } else if ( j > (gint)firsts[i - 1] - from &&
+                            h_prev[j - 1] > none )
+                {
+                    /* consecutive if best alignment ends with match */
+                    c = m_prev[j - 1] == h_prev[j - 1] ? c_prev[j - 1] + 1 : 1;
+                    b = bonus[j];
+                    if (c > 1) {
+                        /* run keeps bonus of its first byte */
+                        fb = bonus[j - c + 1];
+                        if ( b >= BONUS_BOUNDARY && b > fb )
+                            c = 1;
+                        else
+                            b = MAX( b, MAX(BONUS_CONSECUTIVE, fb) );
+                    }
+                    m_cur[j] = h_prev[j - 1] + SCORE_MATCH + b;
+                    c_cur[j] = c;
+                }
+            }
+
+            /* best alignment so far including gap after last match */
+            h_cur[j] = m_cur[j];
+            if ( j > (gint)firsts[i] - from && h_cur[j - 1] > none ) {
+                gap = h_cur[j - 1] + (m_cur[j - 1] == h_cur[j - 1]
+                        ? SCORE_GAP_START : SCORE_GAP_EXTENSION);
+                if (gap > h_cur[j]) {
+                    h_cur[j] = gap;
+                    c_cur[j] = 0;
+                }
+            }
+        }
+
+        swap = m_prev; m_prev = m_cur; m_cur = swap;
+        swap = h_prev; h_prev = h_cur; h_cur = swap;
+        swap = c_prev; c_prev = c_cur; c_cur = swap;
+    }
+
+    for ( j = firsts[m - 1] - from; j < n; ++j )
+        best = MAX(best, m_prev[j]);
+
+    return best;
+}
+
+/**
+ * Scores match of \a pattern in \a text which starts at \a from
+ * (matching each byte at its first occurrence).
+ */
+gint fuzzy_score_greedy( const gchar *pattern,
+                         gsize m,
+                         const gchar *text,
+                         gsize from )
+{
+    gsize i, j, run = 0;
+    gint score = 0, b, first_bonus = 0;
+    gboolean in_gap = FALSE;
+
+    for ( i = 0, j = from; i < m; ++j ) {
+        if ( g_ascii_tolower(text[j]) == pattern[i] ) {
+            b = fuzzy_bonus_at(text, j);
+            if (run == 0) {
+                first_bonus = b;
+            } else {
+                if ( b >= BONUS_BOUNDARY && b > first_bonus )
+                    first_bonus = b;
+                b = MAX( b, MAX(BONUS_CONSECUTIVE, first_bonus) );
+            }
+            score += SCORE_MATCH +
+                (i == 0 ? b * BONUS_FIRST_MULTIPLIER : b);
+            ++run;
+            ++i;
+            in_gap = FALSE;
+        } else if (i > 0) {
+            score += in_gap ? SCORE_GAP_EXTENSION : SCORE_GAP_START;
+            in_gap = TRUE;
+            run = 0;
+        }
+    }
+
+    return score;
+}
+
+/**
+ * Finds non-empty \a pattern (lower case) as subsequence of \a text of
+ * length \a len and sets \a firsts to first possible position of each
+ * pattern byte (at most #FUZZY_MAX_PATTERN positions).
+ * \returns last byte of the match, NULL if text doesn't match
+ */
+const gchar *fuzzy_find_subsequence( const gchar *pattern,
+                                     gsize pattern_len,
+                                     const gchar *text,
+                                     gsize len,
+                                     gsize *firsts )
+{
+    const gchar *s = NULL, *stop;
+    gsize i, pos = 0;
+
+    for ( i = 0; i < pattern_len; ++i ) {
+        s = find_caseless(pattern + i, 1, text + pos, len - pos, len, &stop);
+        if (!s)
+            return NULL;
+        if (i < FUZZY_MAX_PATTERN)
+            firsts[i] = s - text;
+        pos = s - text + 1;
+    }
+
+    return s;
+}
+
+/**
+ * Matches \a pattern (lower case) with \a text of length \a len fuzzily
+ * without scoring the match (see #fuzzy_match).
+ * \returns first matched byte, NULL if text doesn't match
+ */
+const gchar *fuzzy_find( const gchar *pattern,
+                         gsize pattern_len,
+                         const gchar *text,
+                         gsize len )
+{
+    gsize firsts[FUZZY_MAX_PATTERN];
+
+    if (!pattern_len)
+        return text;
+
+    if ( !fuzzy_find_subsequence(pattern, pattern_len, text, len, firsts) )
+        return NULL;
+
+    return text + firsts[0];
+}
+
+/**
+ * Matches \a pattern (lower case) with \a text of length \a len fuzzily.
+ * If \a start is not NULL, it is set to first matched byte.
+ * \returns score of the best match, -1 if text doesn't match
+ */
+gint fuzzy_match( const gchar *pattern,
+                  gsize pattern_len,
+                  const gchar *text,
+                  gsize len,
+                  const gchar **start )
+{
+    const gchar *s;
+    gsize firsts[FUZZY_MAX_PATTERN], lasts[FUZZY_MAX_PATTERN];
+    gsize i, j;
+
+    if (!pattern_len) {
+        if (start)
+            *start = text;
+        return 0;
+    }
+
+    /* pre-filter: find pattern as subsequence (first possible positions) */
+    s = fuzzy_find_subsequence(pattern, pattern_len, text, len, firsts);
+    if (!s)
+        return -1;
+
+    if (start)
+        *start = text + firsts[0];
+
+    if (pattern_len > FUZZY_MAX_PATTERN) {
+        for ( i = pattern_len; i > 0; --s ) {
+            if ( g_ascii_tolower(*s) == pattern[i - 1] )
+                --i;
+        }
+        return fuzzy_score_greedy(pattern, pattern_len, text, s + 1 - text);
+    }
+
+    /* last possible positions (matching pattern backwards from the end) */
+    for ( i = pattern_len, j = len; i > 0; ) {
+        if ( g_ascii_tolower(text[--j]) == pattern[i - 1] )
+            lasts[--i] = j;
+    }
+
+    if ( (lasts[pattern_len - 1] + 1 - firsts[0]) * pattern_len
+            > FUZZY_MAX_CELLS )
+    {
+        /* shortest match ending at end of greedy match */
+        s = text + firsts[pattern_len - 1];
+        for ( i = pattern_len; i > 0; --s ) {
+            if ( g_ascii_tolower(*s) == pattern[i - 1] )
+                --i;
+        }
+        return fuzzy_score_greedy(pattern, pattern_len, text, s + 1 - text);
+    }
+
+    return fuzzy_score_range(pattern, pattern_len, text, firsts, lasts);
+}
@@ -0,0 +1,21 @@
+/**
+ * \file fuzzy.h
+ *
+ * Fuzzy matching and scoring of filter tokens.
+ */
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include <glib.h>
+
+const gchar *fuzzy_find( const gchar *pattern,
+                         gsize pattern_len,
+                         const gchar *text,
+                         gsize len );
+gint fuzzy_match( const gchar *pattern,
+                  gsize pattern_len,
+                  const gchar *text,
+                  gsize len,
+                  const gchar **start );
+
+#endif /* FUZZY_H */
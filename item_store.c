@@ -0,0 +1,380 @@
+/**
+ * \file item_store.c
+ *
+ * List model for items.
+ *
+ * #ItemStore implements GtkTreeModel interface over flat arrays: item texts
+ * (#Item), sort key, one byte of flags, 16-bit icon index and 16-bit match
+ * score per row. Row index is stored directly in GtkTreeIter so iterators
+ * stay valid while rows are appended and accessing a row doesn't need any
+ * lookup.
+ *
+ * Item texts and sort keys are not copied; they are borrowed from reader
+ * (see reader.h). Item texts can be accessed with #item_store_get_item.
+ * Column #COL_TEXT contains only the item index.
+ *
+ * Appending items and changing their visibility doesn't emit any signals,
+ * so no tree view may be attached to the store directly. Items are shown
+ * through #ItemView (item_view.h) which is notified about new items
+ * explicitly and rebuilt in single pass after all items are refiltered.
+ */
+#include "item_store.h"
+
+void item_store_tree_model_init(GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE( ItemStore, item_store, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL,
+                                               item_store_tree_model_init) )
+
+/** Returns TRUE if \a iter points to existing row in \a store. */
+gboolean item_store_iter_is_valid(ItemStore *store, GtkTreeIter *iter)
+{
+    return iter->stamp == store->stamp &&
+        GPOINTER_TO_UINT(iter->user_data) < store->items->len;
+}
+
+/** Sets \a iter to row \a index in \a store. */
+gboolean item_store_set_iter(ItemStore *store, GtkTreeIter *iter, guint index)
+{
+    if ( index >= store->items->len ) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+
+    iter->stamp = store->stamp;
+    iter->user_data = GUINT_TO_POINTER(index);
+
+    return TRUE;
+}
+
+GtkTreeModelFlags item_store_get_flags(GtkTreeModel *model)
+{
+    return GTK_TREE_MODEL_LIST_ONLY | GTK_TREE_MODEL_ITERS_PERSIST;
+}
+
+gint item_store_get_n_columns(GtkTreeModel *model)
+{
+    return NUM_COLS;
+}
+
+GType item_store_get_column_type(GtkTreeModel *model, gint column)
+{
+    switch (column) {
+        case COL_VISIBLE:
+            return G_TYPE_BOOLEAN;
+        case COL_ICON:
+            return GDK_TYPE_PIXBUF;
+        case COL_TEXT:
+            return G_TYPE_UINT;
+        default:
+            return G_TYPE_INVALID;
+    }
+}
+
+gboolean item_store_get_iter( GtkTreeModel *model,
+                              GtkTreeIter *iter,
+                              GtkTreePath *path )
+{
+    if ( gtk_tree_path_get_depth(path) != 1 ) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+
+    return item_store_set_iter( ITEM_STORE(model), iter,
+                                gtk_tree_path_get_indices(path)[0] );
+}
+
+GtkTreePath *item_store_get_path(GtkTreeModel *model, GtkTreeIter *iter)
+{
+    g_return_val_if_fail( item_store_iter_is_valid(ITEM_STORE(model), iter),
+                          NULL );
+
+    return gtk_tree_path_new_from_indices(
+            GPOINTER_TO_UINT(iter->user_data), -1 );
+}
+
+void item_store_get_value( GtkTreeModel *model,
+                           GtkTreeIter *iter,
+                           gint column,
+                           GValue *value )
+{
+    ItemStore *store = ITEM_STORE(model);
+    guint index = GPOINTER_TO_UINT(iter->user_data);
+
+    g_return_if_fail( item_store_iter_is_valid(store, iter) );
+
+    g_value_init( value, item_store_get_column_type(model, column) );
+    switch (column) {
+        case COL_VISIBLE:
+            g_value_set_boolean( value, item_store_get_visible(store, index) );
+            break;
+        case COL_ICON:
+            g_value_set_object( value, g_ptr_array_index(store->icons,
+                        g_array_index(store->icon_ids, guint16, index)) );
+            break;
+        case COL_TEXT:
+            g_value_set_uint(value, index);
+            break;
+    }
+}
+
+gboolean item_store_iter_next(GtkTreeModel *model, GtkTreeIter *iter)
+{
+    return item_store_set_iter( ITEM_STORE(model), iter,
+                                GPOINTER_TO_UINT(iter->user_data) + 1 );
+}
+
+gboolean item_store_iter_previous(GtkTreeModel *model, GtkTreeIter *iter)
+{
+    guint index = GPOINTER_TO_UINT(iter->user_data);
+
+    if (index == 0) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+
+    return item_store_set_iter(ITEM_STORE(model), iter, index - 1);
+}
+
+gboolean item_store_iter_children( GtkTreeModel *model,
+                                   GtkTreeIter *iter,
+                                   GtkTreeIter *parent )
+{
+    if (parent) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+
+    return item_store_set_iter(ITEM_STORE(model), iter, 0);
+}
+
+gboolean item_store_iter_has_child(GtkTreeModel *model, GtkTreeIter *iter)
+{
+    return FALSE;
+}
+
+gint item_store_iter_n_children(GtkTreeModel *model, GtkTreeIter *iter)
+{
+    return iter ? 0 : ITEM_STORE(model)->items->len;
+}
+
+gboolean item_store_iter_nth_child( GtkTreeModel *model,
+                                    GtkTreeIter *iter,
+                                    GtkTreeIter *parent,
+                                    gint n )
+{
+    if ( parent || n < 0 ) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+
+    return item_store_set_iter(ITEM_STORE(model), iter, n);
+}
+
+gboolean item_store_iter_parent( GtkTreeModel *model,
+                                 GtkTreeIter *iter,
+                                 GtkTreeIter *child )
+{
+    iter->stamp = 0;
+    return FALSE;
+}
+
+void item_store_tree_model_init(GtkTreeModelIface *iface)
+{
+    iface->get_flags = item_store_get_flags;
+    iface->get_n_columns = item_store_get_n_columns;
+    iface->get_column_type = item_store_get_column_type;
+    iface->get_iter = item_store_get_iter;
+    iface->get_path = item_store_get_path;
+    iface->get_value = item_store_get_value;
+    iface->iter_next = item_store_iter_next;
+    iface->iter_previous = item_store_iter_previous;
+    iface->iter_children = item_store_iter_children;
+    iface->iter_has_child = item_store_iter_has_child;
+    iface->iter_n_children = item_store_iter_n_children;
+    iface->iter_nth_child = item_store_iter_nth_child;
+    iface->iter_parent = item_store_iter_parent;
+}
+
+void item_store_finalize(GObject *object)
+{
+    ItemStore *store = ITEM_STORE(object);
+    guint i;
+
+    for ( i = 1; i < store->icons->len; ++i )
+        g_object_unref( g_ptr_array_index(store->icons, i) );
+
+    g_array_free(store->items, TRUE);
+    g_byte_array_free(store->flags, TRUE);
+    g_array_free(store->keys, TRUE);
+    g_array_free(store->icon_ids, TRUE);
+    g_array_free(store->scores, TRUE);
+    g_ptr_array_free(store->icons, TRUE);
+
+    G_OBJECT_CLASS(item_store_parent_class)->finalize(object);
+}
+
+static void item_store_class_init(ItemStoreClass *klass)
+{
+    G_OBJECT_CLASS(klass)->finalize = item_store_finalize;
+}
+
+static void item_store_init(ItemStore *store)
+{
+    store->stamp = g_random_int_range(1, G_MAXINT32);
+    store->items = g_array_new( FALSE, FALSE, sizeof(Item) );
+    store->flags = g_byte_array_new();
+    store->keys = g_array_new( FALSE, FALSE, sizeof(const gchar *) );
+    store->icon_ids = g_array_new( FALSE, FALSE, sizeof(guint16) );
+    store->scores = g_array_new( FALSE, FALSE, sizeof(guint16) );
+    store->icons = g_ptr_array_new();
+    /* no icon */
+    g_ptr_array_add(store->icons, NULL);
+}
+
+/** Creates empty item store. */
+ItemStore *item_store_new(void)
+{
+    return g_object_new(TYPE_ITEM_STORE, NULL);
+}
+
+/** Preallocates space for \a size items in \a store. */
+void item_store_reserve(ItemStore *store, guint size)
+{
+    guint len = store->items->len;
+
+    if (size <= len)
+        return;
+
+    /* arrays keep allocated space when shrunk */
+    g_array_set_size(store->items, size);
+    g_array_set_size(store->items, len);
+    g_byte_array_set_size(store->flags, size);
+    g_byte_array_set_size(store->flags, len);
+    g_array_set_size(store->keys, size);
+    g_array_set_size(store->keys, len);
+    g_array_set_size(store->icon_ids, size);
+    g_array_set_size(store->icon_ids, len);
+    g_array_set_size(store->scores, size);
+    g_array_set_size(store->scores, len);
+}
+
+/**
+ * Adds icon to \a store.
+ * \returns icon index for #item_store_append (0 if \a pixbuf is NULL)
+ */
+guint item_store_add_icon(ItemStore *store, GdkPixbuf *pixbuf)
+{
+    if ( !pixbuf || store->icons->len > G_MAXUINT16 )
+        return 0;
+
+    g_ptr_array_add( store->icons, g_object_ref(pixbuf) );
+
+    return store->icons->len - 1;
+}
+
+/**
+ * Appends row with \a text of length \a len, sort \a key (can be NULL) and
+ * \a icon (see #item_store_add_icon).
+ * Text and key are not copied and must stay valid while \a store exists.
+ * Doesn't emit "row-inserted" (see #ItemStore).
+ * \returns index of new row
+ */
+guint item_store_append( ItemStore *store,
+                         const gchar *text,
+                         gsize len,
+                         const gchar *key,
+                         guint icon,
+                         gboolean visible )
+{
+    Item item;
+    guint8 flags = visible ? ITEM_VISIBLE : 0;
+    guint16 icon_id = icon, score = 0;
+    guint index = store->items->len;
+
+    item.text = text;
+    item.len = len;
+    g_array_append_val(store->items, item);
+    g_array_append_val(store->keys, key);
+    g_byte_array_append(store->flags, &flags, 1);
+    g_array_append_val(store->icon_ids, icon_id);
+    g_array_append_val(store->scores, score);
+
+    return index;
+}
+
+/** Returns number of rows in \a store. */
+guint item_store_get_length(const ItemStore *store)
+{
+    return store->items->len;
+}
+
+/** Returns index of row given by \a iter. */
+guint item_store_get_index(const ItemStore *store, const GtkTreeIter *iter)
+{
+    return GPOINTER_TO_UINT(iter->user_data);
+}
+
+/** Returns item in row \a index (text is not copied). */
+const Item *item_store_get_item(const ItemStore *store, guint index)
+{
+    return &g_array_index(store->items, Item, index);
+}
+
+/** Returns sort key of row \a index (NULL if not computed). */
+const gchar *item_store_get_key(const ItemStore *store, guint index)
+{
+    return g_array_index(store->keys, const gchar *, index);
+}
+
+/** Returns TRUE if row \a index is visible. */
+gboolean item_store_get_visible(const ItemStore *store, guint index)
+{
+    return (store->flags->data[index] & ITEM_VISIBLE) != 0;
+}
+
+/**
+ * Sets visibility of all rows.
+ * No signal is emitted (see #item_view_refilter).
+ */
+void item_store_set_all_visible(ItemStore *store, gboolean visible)
+{
+    guint8 *flags = store->flags->data;
+    guint i, len = store->flags->len;
+
+    for ( i = 0; i < len; ++i ) {
+        if (visible)
+            flags[i] |= ITEM_VISIBLE;
+        else
+            flags[i] &= ~ITEM_VISIBLE;
+    }
+}
+
+/**
+ * Sets visibility of row \a index.
+ * No signal is emitted (see #item_view_refilter).
+ */
+void item_store_set_visible(ItemStore *store, guint index, gboolean visible)
+{
+    guint8 *flags = &store->flags->data[index];
+
+    if (visible)
+        *flags |= ITEM_VISIBLE;
+    else
+        *flags &= ~ITEM_VISIBLE;
+}
+
+/** Returns match score of row \a index (see #item_store_set_score). */
+guint item_store_get_score(const ItemStore *store, guint index)
+{
+    return g_array_index(store->scores, guint16, index);
+}
+
+/**
+ * Sets match score of row \a index (see #match_query_score).
+ * Scores are clamped to 16 bits. No signal is emitted.
+ */
+void item_store_set_score(ItemStore *store, guint index, gint score)
+{
+    g_array_index(store->scores, guint16, index) = CLAMP(score, 0, G_MAXUINT16);
+}
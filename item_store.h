@@ -0,0 +1,92 @@
+/**
+ * \file item_store.h
+ *
+ * List model for items.
+ */
+#ifndef ITEM_STORE_H
+#define ITEM_STORE_H
+
+#include <gtk/gtk.h>
+
+/**\{ \name Type macros */
+#define TYPE_ITEM_STORE (item_store_get_type())
+#define ITEM_STORE(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST((obj), TYPE_ITEM_STORE, ItemStore))
+#define IS_ITEM_STORE(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE((obj), TYPE_ITEM_STORE))
+/**\}*/
+
+/** columns in item store */
+enum
+{
+    /** visibility toggle */
+    COL_VISIBLE,
+    /** file icon or empty */
+    COL_ICON,
+    /** item index in store (see #item_store_get_item) */
+    COL_TEXT,
+    /** number of columns */
+    NUM_COLS
+};
+
+/** item text */
+typedef struct {
+    /** item text (raw bytes, not zero-terminated, owned by reader) */
+    const gchar *text;
+    /** length of Item::text */
+    gsize len;
+} Item;
+
+/**
+ * List model for items.
+ * Rows are kept in flat arrays indexed by row number.
+ * Store doesn't emit any signals; show items through #ItemView.
+ */
+typedef struct {
+    GObject parent;
+
+    /** stamp for validating iterators */
+    gint stamp;
+    /** item texts (#Item) */
+    GArray *items;
+    /** item flags (#ITEM_VISIBLE) */
+    GByteArray *flags;
+    /** icon index for each item (guint16, 0 for no icon) */
+    GArray *icon_ids;
+    /** sort key for each item (const gchar *, see sort_key.h) */
+    GArray *keys;
+    /** match score for each item (guint16, see #item_store_set_score) */
+    GArray *scores;
+    /** icons (#GdkPixbuf, first is NULL) */
+    GPtrArray *icons;
+} ItemStore;
+
+typedef struct {
+    GObjectClass parent_class;
+} ItemStoreClass;
+
+/** item is visible */
+#define ITEM_VISIBLE 1
+
+GType item_store_get_type(void);
+ItemStore *item_store_new(void);
+void item_store_reserve(ItemStore *store, guint size);
+guint item_store_add_icon(ItemStore *store, GdkPixbuf *pixbuf);
+guint item_store_append( ItemStore *store,
+                         const gchar *text,
+                         gsize len,
+                         const gchar *key,
+                         guint icon,
+                         gboolean visible );
+
+guint item_store_get_length(const ItemStore *store);
+guint item_store_get_index(const ItemStore *store, const GtkTreeIter *iter);
+const Item *item_store_get_item(const ItemStore *store, guint index);
+const gchar *item_store_get_key(const ItemStore *store, guint index);
+gboolean item_store_get_visible(const ItemStore *store, guint index);
+void item_store_set_visible(ItemStore *store, guint index, gboolean visible);
+void item_store_set_all_visible(ItemStore *store, gboolean visible);
+guint item_store_get_score(const ItemStore *store, guint index);
+void item_store_set_score(ItemStore *store, guint index, gint score);
+
+#endif /* ITEM_STORE_H */
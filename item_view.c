@@ -0,0 +1,875 @@
+/**
+ * \file item_view.c
+ *
+ * List model with visible items from item store in display order.
+ *
+ * #ItemView replaces stacked GtkTreeModelFilter and GtkTreeModelSort.
+ * It keeps array of store indexes of visible items (ItemView::rows) and,
+ * if sorting is enabled, array of all store indexes in sort order
+ * (ItemView::order).
+ *
+ * After visibility of items in store changes, #item_view_refilter rebuilds
+ * the visible rows in single pass over the store (or over the sort order)
+ * without emitting any signals, so the view should be detached from tree
+ * view (the coarsest change notification available) while refiltering.
+ * #item_view_refilter_partial shows only items which were already refiltered
+ * so results can be shown while the rest of items is being filtered; items
+ * refiltered later are shown with #item_view_show_range which emits
+ * "row-inserted" only for the new rows, so the view is detached only once
+ * per pass. #item_view_refilter_notify rebuilds the rows and emits signals
+ * for all old and new rows, e.g. after sort order is replaced.
+ *
+ * New items are added with #item_view_append which emits "row-inserted"
+ * only if the item is visible. Sorted position is found by binary search.
+ * Items added to store in a batch are added with #item_view_append_range;
+ * in sorted view the batch is sorted and merged into the sort order and
+ * visible rows in single pass instead of moving the rest of the arrays for
+ * each item; "row-inserted" is then emitted only for the new visible rows,
+ * so tree view doesn't need to be detached and keeps scroll position and
+ * cursor. Order of all items can also be computed elsewhere (e.g. in
+ * parallel, see parallel_sort.h) and installed with #item_view_set_order.
+ *
+ * #item_view_reorder switches to other precomputed order of all items (see
+ * sort_order.h) without comparing items: visible rows are sorted by their
+ * positions in the new order with radix sort in O(k) time for k visible
+ * rows, so switching order doesn't depend on number of hidden items.
+ *
+ * #item_view_rank moves rows with the highest match score (see
+ * #item_store_get_score) to the top. Only these rows are sorted; they are
+ * selected with a bounded heap so ranking takes O(n log k) time for n
+ * visible rows and k ranked rows. Tree view is notified with single
+ * "rows-reordered" signal.
+ */
+#include "item_view.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/** number of bits of item rank sorted in one pass of #item_view_reorder */
+#define RADIX_BITS 11
+
+void item_view_tree_model_init(GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE( ItemView, item_view, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL,
+                                               item_view_tree_model_init) )
+
+/** Returns TRUE if \a iter points to existing row in \a view. */
+gboolean item_view_iter_is_valid(ItemView *view, GtkTreeIter *iter)
+{
+    return iter->stamp == view->stamp &&
+        GPOINTER_TO_UINT(iter->user_data) < view->rows->len;
+}
+
+/** Sets \a iter to row \a row in \a view. */
+gboolean item_view_set_iter(ItemView *view, GtkTreeIter *iter, guint row)
+{
+    if ( row >= view->rows->len ) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+
+    iter->stamp = view->stamp;
+    iter->user_data = GUINT_TO_POINTER(row);
+
+    return TRUE;
+}
+
+GtkTreeModelFlags item_view_get_flags(GtkTreeModel *model)
+{
+    return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+gint item_view_get_n_columns(GtkTreeModel *model)
+{
+    return gtk_tree_model_get_n_columns(
+            GTK_TREE_MODEL(ITEM_VIEW(model)->store) );
+}
+
+GType item_view_get_column_type(GtkTreeModel *model, gint column)
+{
+    return gtk_tree_model_get_column_type(
+            GTK_TREE_MODEL(ITEM_VIEW(model)->store), column );
+}
+
+gboolean item_view_get_iter( GtkTreeModel *model,
+                             GtkTreeIter *iter,
+                             GtkTreePath *path )
+{
+    if ( gtk_tree_path_get_depth(path) != 1 ) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+
+    return item_view_set_iter( ITEM_VIEW(model), iter,
+                               gtk_tree_path_get_indices(path)[0] );
+}
+
+GtkTreePath *item_view_get_path(GtkTreeModel *model, GtkTreeIter *iter)
+{
+    g_return_val_if_fail( item_view_iter_is_valid(ITEM_VIEW(model), iter),
+                          NULL );
+
+    return gtk_tree_path_new_from_indices(
+            GPOINTER_TO_UINT(iter->user_data), -1 );
+}
+
+void item_view_get_value( GtkTreeModel *model,
+                          GtkTreeIter *iter,
+                          gint column,
+                          GValue *value )
+{
+    ItemView *view = ITEM_VIEW(model);
+    GtkTreeModel *store = GTK_TREE_MODEL(view->store);
+    GtkTreeIter child;
+
+    g_return_if_fail( item_view_iter_is_valid(view, iter) );
+
+    gtk_tree_model_iter_nth_child( store, &child, NULL,
+                                   item_view_get_index(view, iter) );
+    gtk_tree_model_get_value(store, &child, column, value);
+}
+
+gboolean item_view_iter_next(GtkTreeModel *model, GtkTreeIter *iter)
+{
+    return item_view_set_iter( ITEM_VIEW(model), iter,
+                               GPOINTER_TO_UINT(iter->user_data) + 1 );
+}
+
+gboolean item_view_iter_previous(GtkTreeModel *model, GtkTreeIter *iter)
+{
+    guint row = GPOINTER_TO_UINT(iter->user_data);
+
+    if (row == 0) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+
+    return item_view_set_iter(ITEM_VIEW(model), iter, row - 1);
+}
+
+gboolean item_view_iter_children( GtkTreeModel *model,
+                                  GtkTreeIter *iter,
+                                  GtkTreeIter *parent )
+{
+    if (parent) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+
+    return item_view_set_iter(ITEM_VIEW(model), iter, 0);
+}
+
+gboolean item_view_iter_has_child(GtkTreeModel *model, GtkTreeIter *iter)
+{
+    return FALSE;
+}
+
+gint item_view_iter_n_children(GtkTreeModel *model, GtkTreeIter *iter)
+{
+    return iter ? 0 : ITEM_VIEW(model)->rows->len;
+}
+
+gboolean item_view_iter_nth_child( GtkTreeModel *model,
+                                   GtkTreeIter *iter,
+                                   GtkTreeIter *parent,
+                                   gint n )
+{
+    if ( parent || n < 0 ) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+
+    return item_view_set_iter(ITEM_VIEW(model), iter, n);
+}
+
+gboolean item_view_iter_parent( GtkTreeModel *model,
+                                GtkTreeIter *iter,
+                                GtkTreeIter *child )
+{
+    iter->stamp = 0;
+    return FALSE;
+}
+
+void item_view_tree_model_init(GtkTreeModelIface *iface)
+{
+    iface->get_flags = item_view_get_flags;
+    iface->get_n_columns = item_view_get_n_columns;
+    iface->get_column_type = item_view_get_column_type;
+    iface->get_iter = item_view_get_iter;
+    iface->get_path = item_view_get_path;
+    iface->get_value = item_view_get_value;
+    iface->iter_next = item_view_iter_next;
+    iface->iter_previous = item_view_iter_previous;
+    iface->iter_children = item_view_iter_children;
+    iface->iter_has_child = item_view_iter_has_child;
+    iface->iter_n_children = item_view_iter_n_children;
+    iface->iter_nth_child = item_view_iter_nth_child;
+    iface->iter_parent = item_view_iter_parent;
+}
+
+void item_view_finalize(GObject *object)
+{
+    ItemView *view = ITEM_VIEW(object);
+
+    g_array_free(view->rows, TRUE);
+    if (view->order)
+        g_array_unref(view->order);
+    g_free(view->ranks);
+    g_object_unref(view->store);
+
+    G_OBJECT_CLASS(item_view_parent_class)->finalize(object);
+}
+
+static void item_view_class_init(ItemViewClass *klass)
+{
+    G_OBJECT_CLASS(klass)->finalize = item_view_finalize;
+}
+
+static void item_view_init(ItemView *view)
+{
+    view->stamp = g_random_int_range(1, G_MAXINT32);
+    view->store = NULL;
+    view->rows = g_array_new( FALSE, FALSE, sizeof(guint) );
+    view->order = NULL;
+    view->compare = NULL;
+    view->compare_data = NULL;
+    view->ranked = 0;
+    view->ranks = NULL;
+}
+
+/** Creates view with visible items in \a store. */
+ItemView *item_view_new(ItemStore *store)
+{
+    ItemView *view = g_object_new(TYPE_ITEM_VIEW, NULL);
+
+    view->store = g_object_ref(store);
+    item_view_refilter(view);
+
+    return view;
+}
+
+/** Compares store indexes pointed to by \a a and \a b. */
+gint item_view_compare(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    ItemView *view = (ItemView *)user_data;
+
+    return view->compare( *(const guint *)a, *(const guint *)b,
+                          view->compare_data );
+}
+
+/** Compares store indexes \a a and \a b (input order). */
+gint item_view_compare_indexes(guint a, guint b, gpointer user_data)
+{
+    return (a > b) - (a < b);
+}
+
+/** Compares items \a a and \a b by their position in sort order. */
+gint item_view_compare_ranks(guint a, guint b, gpointer ranks)
+{
+    const guint *r = (const guint *)ranks;
+
+    return (r[a] > r[b]) - (r[a] < r[b]);
+}
+
+/** Compares store indexes pointed to by \a a and \a b by \a ranks. */
+gint item_view_compare_ranked( gconstpointer a,
+                               gconstpointer b,
+                               gpointer ranks )
+{
+    return item_view_compare_ranks( *(const guint *)a, *(const guint *)b,
+                                    ranks );
+}
+
+/** Forgets positions of items after sort order changed. */
+void item_view_order_changed(ItemView *view)
+{
+    g_free(view->ranks);
+    view->ranks = NULL;
+}
+
+/**
+ * Returns position of each item in sort order (computed on first use after
+ * the order changed; G_MAXUINT for items not added to the order yet).
+ */
+const guint *item_view_get_ranks(ItemView *view)
+{
+    const guint *order = (const guint *)view->order->data;
+    guint i, len = item_store_get_length(view->store);
+
+    if (!view->ranks) {
+        view->ranks = g_new(guint, MAX(len, 1));
+        memset( view->ranks, 0xff, len * sizeof(guint) );
+        for ( i = 0; i < view->order->len; ++i )
+            view->ranks[order[i]] = i;
+    }
+
+    return view->ranks;
+}
+
+/**
+ * Finds position for item \a index in \a items between \a from and \a to
+ * (excluding) sorted with \a compare.
+ * \returns position after all items which are not greater than the item
+ */
+guint item_view_search( ItemCompareFunc compare,
+                        gpointer data,
+                        const guint *items,
+                        guint from,
+                        guint to,
+                        guint index )
+{
+    guint mid;
+
+    while (from < to) {
+        mid = from + (to - from) / 2;
+        if ( compare(index, items[mid], data) < 0 )
+            to = mid;
+        else
+            from = mid + 1;
+    }
+
+    return from;
+}
+
+/**
+ * Finds position for item \a index in sorted \a array (items before \a from
+ * are skipped).
+ * \returns position after all items which are not greater than the item
+ */
+guint item_view_find_position( ItemView *view,
+                               GArray *array,
+                               guint from,
+                               guint index )
+{
+    return item_view_search( view->compare, view->compare_data,
+                             (const guint *)array->data,
+                             from, array->len, index );
+}
+
+/**
+ * Merges \a count store indexes \a items into \a array (both sorted with
+ * \a compare; items before \a from are not moved).
+ * Items already in \a array go before equal new items.
+ * If \a positions is not NULL, it is set to new position of each merged
+ * item (ascending; can be the same array as \a items).
+ *
+ * Position of each new item is found by galloping search (doubling steps
+ * from position of the previous item, then binary search), so merging
+ * takes O(k log(n/k)) comparisons. Items between the positions are moved
+ * at once, so each of n items in array is moved at most once.
+ */
+void item_view_merge( ItemCompareFunc compare,
+                      gpointer data,
+                      GArray *array,
+                      guint from,
+                      const guint *items,
+                      guint count,
+                      guint *positions )
+{
+    guint i = array->len, j = count, pos, hi, step;
+    guint *a;
+
+    g_array_set_size(array, array->len + count);
+    a = (guint *)array->data;
+
+    /* merge from the end so each item is moved once */
+    for ( ; j > 0; --j ) {
+        hi = i;
+        for ( step = 1; hi - from > step &&
+                        compare(items[j - 1], a[hi - step], data) < 0;
+              step *= 2 )
+            hi -= step;
+        pos = item_view_search( compare, data, a,
+                                hi - from > step ? hi - step : from,
+                                hi, items[j - 1] );
+        memmove( a + pos + j, a + pos, (i - pos) * sizeof(guint) );
+        a[pos + j - 1] = items[j - 1];
+        if (positions)
+            positions[j - 1] = pos + j - 1;
+        i = pos;
+    }
+}
+
+/**
+ * Sorts items using \a func.
+ * Sorts all items in store and rebuilds visible rows
+ * (see #item_view_refilter).
+ */
+void item_view_set_sort_func( ItemView *view,
+                              ItemCompareFunc func,
+                              gpointer user_data )
+{
+    guint i, len = item_store_get_length(view->store);
+
+    view->compare = func;
+    view->compare_data = user_data;
+    item_view_order_changed(view);
+
+    if (view->order) {
+        g_array_unref(view->order);
+        view->order = NULL;
+    }
+
+    if (func) {
+        view->order = g_array_sized_new( FALSE, FALSE, sizeof(guint), len );
+        for ( i = 0; i < len; ++i )
+            g_array_append_val(view->order, i);
+        g_array_sort_with_data(view->order, item_view_compare, view);
+    }
+
+    item_view_refilter(view);
+}
+
+/**
+ * Replaces sort order with \a order (indexes of all items in store sorted
+ * with compare function of the view, e.g. by #parallel_sort).
+ * Takes ownership of \a order (one reference).
+ * Visible rows must be rebuilt afterwards (see #item_view_refilter and
+ * #item_view_refilter_notify).
+ */
+void item_view_set_order(ItemView *view, GArray *order)
+{
+    g_return_if_fail( view->order &&
+                      order->len == item_store_get_length(view->store) );
+
+    g_array_unref(view->order);
+    view->order = order;
+    item_view_order_changed(view);
+}
+
+/**
+ * Switches to other sort \a order (indexes of all items in store) and
+ * reorders visible rows without comparing items.
+ * Array \a ranks contains position of each item in \a order.
+ * Adds reference to \a order. Compare function of the view is not used
+ * for the new order so items must not be added to view afterwards.
+ * Rows ranked by score are not kept on top.
+ * Doesn't emit any signals; existing iterators are invalidated.
+ */
+void item_view_reorder(ItemView *view, GArray *order, const guint *ranks)
+{
+    guint *rows = (guint *)view->rows->data;
+    guint *from = rows, *to, *buffer, *swap;
+    guint len = view->rows->len, last = order->len - 1;
+    guint counts[1 << RADIX_BITS];
+    guint i, shift, digit, sum, count;
+
+    g_return_if_fail( order->len == item_store_get_length(view->store) );
+
+    g_array_ref(order);
+    if (view->order)
+        g_array_unref(view->order);
+    view->order = order;
+    item_view_order_changed(view);
+
+    /* least significant digit first (stable), only digits used by ranks */
+    buffer = to = g_new(guint, MAX(len, 1));
+    for ( shift = 0; len > 1 && shift < 32 && last >> shift;
+          shift += RADIX_BITS )
+    {
+        memset( counts, 0, sizeof(counts) );
+        for ( i = 0; i < len; ++i )
+            ++counts[ (ranks[from[i]] >> shift) & ((1 << RADIX_BITS) - 1) ];
+
+        for ( digit = 0, sum = 0; digit < (1 << RADIX_BITS); ++digit ) {
+            count = counts[digit];
+            counts[digit] = sum;
+            sum += count;
+        }
+
+        for ( i = 0; i < len; ++i ) {
+            digit = (ranks[from[i]] >> shift) & ((1 << RADIX_BITS) - 1);
+            to[ counts[digit]++ ] = from[i];
+        }
+
+        swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != rows)
+        memcpy( rows, from, len * sizeof(guint) );
+    g_free(buffer);
+    view->ranked = 0;
+
+    /* invalidate iterators */
+    view->stamp = view->stamp % G_MAXINT32 + 1;
+}
+
+/**
+ * Adds new item with \a index in store to view.
+ * Emits "row-inserted" if the item is visible.
+ */
+void item_view_append(ItemView *view, guint index)
+{
+    guint row;
+    GtkTreeIter iter;
+    GtkTreePath *path;
+
+    if (view->order) {
+        row = item_view_find_position(view, view->order, 0, index);
+        g_array_insert_val(view->order, row, index);
+        item_view_order_changed(view);
+    }
+
+    if ( !item_store_get_visible(view->store, index) )
+        return;
+
+    /* ranked rows stay on top */
+    row = view->order
+        ? item_view_find_position(view, view->rows, view->ranked, index)
+        : view->rows->len;
+    g_array_insert_val(view->rows, row, index);
+
+    item_view_set_iter(view, &iter, row);
+    path = gtk_tree_path_new_from_indices(row, -1);
+    gtk_tree_model_row_inserted( GTK_TREE_MODEL(view), path, &iter );
+    gtk_tree_path_free(path);
+}
+
+/**
+ * Merges \a count store indexes \a items (sorted with \a compare like
+ * visible rows) into visible rows after ranked rows and emits "row-inserted"
+ * for each new row in ascending order of rows, so rows before the inserted
+ * one are always the rows which tree view already knows about.
+ * Items are overwritten with the new row numbers.
+ * Existing iterators are invalidated if \a count is not zero.
+ */
+void item_view_insert_rows( ItemView *view,
+                            guint *items,
+                            guint count,
+                            ItemCompareFunc compare,
+                            gpointer data )
+{
+    guint i;
+    GtkTreeIter iter;
+    GtkTreePath *path;
+
+    if (!count)
+        return;
+
+    /* ranked rows stay on top */
+    item_view_merge( compare, data, view->rows, view->ranked,
+                     items, count, items );
+    view->stamp = view->stamp % G_MAXINT32 + 1;
+
+    for ( i = 0; i < count; ++i ) {
+        item_view_set_iter(view, &iter, items[i]);
+        path = gtk_tree_path_new_from_indices(items[i], -1);
+        gtk_tree_model_row_inserted( GTK_TREE_MODEL(view), path, &iter );
+        gtk_tree_path_free(path);
+    }
+}
+
+/**
+ * Adds new items with indexes from \a from to the end of store
+ * (items appended to store since last call).
+ *
+ * If view is unsorted, visible items are appended and "row-inserted" is
+ * emitted for each of them (see #item_view_append).
+ *
+ * If view is sorted, new items are sorted and merged into the sort order
+ * and into visible rows in single pass, so adding k items to n rows takes
+ * O(n + k log k) time. Signals are emitted after all rows are merged (see
+ * #item_view_insert_rows).
+ */
+void item_view_append_range(ItemView *view, guint from)
+{
+    guint i, n = 0, len = item_store_get_length(view->store);
+    GArray *items;
+    guint *data;
+
+    if (!view->order) {
+        for ( i = from; i < len; ++i )
+            item_view_append(view, i);
+        return;
+    }
+
+    if (from >= len)
+        return;
+
+    items = g_array_sized_new( FALSE, FALSE, sizeof(guint), len - from );
+    for ( i = from; i < len; ++i )
+        g_array_append_val(items, i);
+    g_array_sort_with_data(items, item_view_compare, view);
+    data = (guint *)items->data;
+
+    item_view_merge( view->compare, view->compare_data,
+                     view->order, 0, data, items->len, NULL );
+    item_view_order_changed(view);
+
+    for ( i = 0; i < items->len; ++i ) {
+        if ( item_store_get_visible(view->store, data[i]) )
+            data[n++] = data[i];
+    }
+
+    item_view_insert_rows( view, data, n, view->compare, view->compare_data );
+
+    g_array_free(items, TRUE);
+}
+
+/**
+ * Shows visible items with indexes from \a from to \a to (excluding) which
+ * are hidden in view, e.g. items refiltered after
+ * #item_view_refilter_partial was called with \a from.
+ * Items not added to sort order yet stay hidden.
+ * New rows are merged like in #item_view_append_range, so tree view
+ * processes only the new rows instead of rebuilding the whole list.
+ */
+void item_view_show_range(ItemView *view, guint from, guint to)
+{
+    const guint *ranks = view->order ? item_view_get_ranks(view) : NULL;
+    GArray *items;
+    guint i;
+
+    to = MIN( to, item_store_get_length(view->store) );
+    if (from >= to)
+        return;
+
+    items = g_array_new( FALSE, FALSE, sizeof(guint) );
+    for ( i = from; i < to; ++i ) {
+        if ( item_store_get_visible(view->store, i) &&
+             (!ranks || ranks[i] != G_MAXUINT) )
+            g_array_append_val(items, i);
+    }
+
+    if (ranks) {
+        g_array_sort_with_data( items, item_view_compare_ranked,
+                                (gpointer)ranks );
+        item_view_insert_rows( view, (guint *)items->data, items->len,
+                               item_view_compare_ranks, (gpointer)ranks );
+    } else {
+        item_view_insert_rows( view, (guint *)items->data, items->len,
+                               item_view_compare_indexes, NULL );
+    }
+
+    g_array_free(items, TRUE);
+}
+
+/**
+ * Rebuilds visible rows from visibility of items in store.
+ * Doesn't emit any signals; existing iterators are invalidated.
+ */
+void item_view_refilter(ItemView *view)
+{
+    item_view_refilter_partial( view, item_store_get_length(view->store) );
+}
+
+/**
+ * Rebuilds visible rows from visibility of first \a count items in store.
+ * Other items are hidden.
+ * Doesn't emit any signals; existing iterators are invalidated.
+ */
+void item_view_refilter_partial(ItemView *view, guint count)
+{
+    const ItemStore *store = view->store;
+    guint i, index, n = 0, len = item_store_get_length(store);
+    const guint *order = view->order ? (const guint *)view->order->data : NULL;
+    guint *rows;
+
+    /* items not added to sort order yet stay hidden */
+    len = order ? view->order->len : MIN(len, count);
+
+    g_array_set_size(view->rows, len);
+    rows = (guint *)view->rows->data;
+    for ( i = 0; i < len; ++i ) {
+        index = order ? order[i] : i;
+        if ( index < count && item_store_get_visible(store, index) )
+            rows[n++] = index;
+    }
+    g_array_set_size(view->rows, n);
+    view->ranked = 0;
+
+    /* invalidate iterators */
+    view->stamp = view->stamp % G_MAXINT32 + 1;
+}
+
+/**
+ * Rebuilds visible rows like #item_view_refilter_partial and notifies tree
+ * view instead of requiring it to be detached: "row-deleted" is emitted for
+ * each old row (from the last one) and "row-inserted" for each new row.
+ */
+void item_view_refilter_notify(ItemView *view, guint count)
+{
+    guint i;
+    GtkTreeIter iter;
+    GtkTreePath *path;
+
+    for ( i = view->rows->len; i > 0; --i ) {
+        g_array_set_size(view->rows, i - 1);
+        path = gtk_tree_path_new_from_indices(i - 1, -1);
+        gtk_tree_model_row_deleted( GTK_TREE_MODEL(view), path );
+        gtk_tree_path_free(path);
+    }
+
+    item_view_refilter_partial(view, count);
+
+    for ( i = 0; i < view->rows->len; ++i ) {
+        item_view_set_iter(view, &iter, i);
+        path = gtk_tree_path_new_from_indices(i, -1);
+        gtk_tree_model_row_inserted( GTK_TREE_MODEL(view), path, &iter );
+        gtk_tree_path_free(path);
+    }
+}
+
+/**
+ * Returns TRUE if row \a a should be ranked before row \a b
+ * (higher score or the same score and earlier row).
+ */
+gboolean item_view_rank_before(const ItemView *view, guint a, guint b)
+{
+    const guint *rows = (const guint *)view->rows->data;
+    guint score_a = item_store_get_score(view->store, rows[a]);
+    guint score_b = item_store_get_score(view->store, rows[b]);
+
+    return score_a > score_b || (score_a == score_b && a < b);
+}
+
+/** Restores heap of rows in \a heap (worst row first) from position \a i. */
+void item_view_sift_down( const ItemView *view,
+                          guint *heap,
+                          guint len,
+                          guint i )
+{
+    guint child, row;
+
+    for ( ; (child = 2 * i + 1) < len; i = child ) {
+        if ( child + 1 < len &&
+             item_view_rank_before(view, heap[child], heap[child + 1]) )
+            ++child;
+        if ( !item_view_rank_before(view, heap[i], heap[child]) )
+            break;
+        row = heap[i];
+        heap[i] = heap[child];
+        heap[child] = row;
+    }
+}
+
+/** Compares row numbers. */
+gint item_view_compare_rows(gconstpointer a, gconstpointer b)
+{
+    guint x = *(const guint *)a, y = *(const guint *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Moves at most \a count visible rows with the highest score to the top
+ * ordered by score (rows with the same score keep their order).
+ * Order of other rows doesn't change.
+ * Emits "rows-reordered"; existing iterators are invalidated.
+ */
+void item_view_rank(ItemView *view, guint count)
+{
+    guint *rows = (guint *)view->rows->data;
+    guint i, j, k, n = 0, len = view->rows->len, row;
+    guint *heap, *selected, *top;
+    gint *new_order;
+    GtkTreePath *path;
+
+    count = MIN(count, len);
+    if (!count)
+        return;
+
+    /* select best rows (worst of them on top of heap) */
+    heap = g_new(guint, count);
+    for ( i = 0; i < len; ++i ) {
+        if (n < count) {
+            heap[n++] = i;
+            for ( j = n - 1; j > 0; j = k ) {
+                k = (j - 1) / 2;
+                if ( !item_view_rank_before(view, heap[k], heap[j]) )
+                    break;
+                row = heap[k];
+                heap[k] = heap[j];
+                heap[j] = row;
+            }
+        } else if ( item_view_rank_before(view, i, heap[0]) ) {
+            heap[0] = i;
+            item_view_sift_down(view, heap, n, 0);
+        }
+    }
+
+    /* rows in rank order (pop the worst to the end) */
+    selected = g_memdup2( heap, count * sizeof(guint) );
+    top = g_new(guint, count);
+    new_order = g_new(gint, len);
+    for ( i = count; i > 0; --i ) {
+        top[i - 1] = rows[heap[0]];
+        new_order[i - 1] = heap[0];
+        heap[0] = heap[--n];
+        item_view_sift_down(view, heap, n, 0);
+    }
+
+    /* move other rows (in the same order) after the ranked ones */
+    qsort( selected, count, sizeof(guint), item_view_compare_rows );
+    for ( i = len, j = len, k = count; i > 0; --i ) {
+        if ( k > 0 && selected[k - 1] == i - 1 ) {
+            --k;
+        } else {
+            rows[--j] = rows[i - 1];
+            new_order[j] = i - 1;
+        }
+    }
+    memcpy( rows, top, count * sizeof(guint) );
+    view->ranked = count;
+
+    g_free(heap);
+    g_free(selected);
+    g_free(top);
+
+    /* invalidate iterators */
+    view->stamp = view->stamp % G_MAXINT32 + 1;
+
+    path = gtk_tree_path_new();
+    gtk_tree_model_rows_reordered( GTK_TREE_MODEL(view), path, NULL,
+                                   new_order );
+    gtk_tree_path_free(path);
+    g_free(new_order);
+}
+
+/**
+ * Returns indexes of all items in store in sort order
+ * (NULL if view is unsorted).
+ */
+GArray *item_view_get_order(const ItemView *view)
+{
+    return view->order;
+}
+
+/** Returns TRUE if items are sorted (see #item_view_set_sort_func). */
+gboolean item_view_is_sorted(const ItemView *view)
+{
+    return view->order != NULL;
+}
+
+/**
+ * Finds row with item \a index in store.
+ * \returns row number or -1 if the item is not visible
+ */
+gint item_view_find_row(const ItemView *view, guint index)
+{
+    const guint *rows = (const guint *)view->rows->data;
+    guint i;
+
+    for ( i = 0; i < view->rows->len; ++i ) {
+        if (rows[i] == index)
+            return i;
+    }
+
+    return -1;
+}
+
+/** Returns number of visible rows. */
+guint item_view_get_length(const ItemView *view)
+{
+    return view->rows->len;
+}
+
+/** Returns index of item in store for row given by \a iter. */
+guint item_view_get_index(const ItemView *view, const GtkTreeIter *iter)
+{
+    return g_array_index( view->rows, guint,
+                          GPOINTER_TO_UINT(iter->user_data) );
+}
@@ -0,0 +1,80 @@
+/**
+ * \file item_view.h
+ *
+ * List model with visible items from item store in display order.
+ */
+#ifndef ITEM_VIEW_H
+#define ITEM_VIEW_H
+
+#include "item_store.h"
+
+/**\{ \name Type macros */
+#define TYPE_ITEM_VIEW (item_view_get_type())
+#define ITEM_VIEW(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST((obj), TYPE_ITEM_VIEW, ItemView))
+#define IS_ITEM_VIEW(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE((obj), TYPE_ITEM_VIEW))
+/**\}*/
+
+/**
+ * Compares items with indexes \a a and \a b in item store.
+ * \returns negative value if \a a sorts before \a b, positive value if
+ * \a a sorts after \a b, zero if the items are equal
+ */
+typedef gint (*ItemCompareFunc)(guint a, guint b, gpointer user_data);
+
+/**
+ * List model with visible items from item store.
+ * Rows are indexes of visible items in store (permutation of the store
+ * if items are sorted).
+ */
+typedef struct {
+    GObject parent;
+
+    /** stamp for validating iterators */
+    gint stamp;
+    /** item store */
+    ItemStore *store;
+    /** indexes of visible items in store in display order (guint) */
+    GArray *rows;
+    /** indexes of all items in store in sort order (guint, NULL if unsorted) */
+    GArray *order;
+    /** function for sorting items (NULL if unsorted) */
+    ItemCompareFunc compare;
+    /** data for ItemView::compare */
+    gpointer compare_data;
+    /** number of rows at the beginning ordered by score (#item_view_rank) */
+    guint ranked;
+    /**
+     * position of each item in ItemView::order (G_MAXUINT for items not in
+     * order yet; computed on first use, NULL if order changed)
+     */
+    guint *ranks;
+} ItemView;
+
+typedef struct {
+    GObjectClass parent_class;
+} ItemViewClass;
+
+GType item_view_get_type(void);
+ItemView *item_view_new(ItemStore *store);
+void item_view_set_sort_func( ItemView *view,
+                              ItemCompareFunc func,
+                              gpointer user_data );
+void item_view_set_order(ItemView *view, GArray *order);
+void item_view_reorder(ItemView *view, GArray *order, const guint *ranks);
+void item_view_append(ItemView *view, guint index);
+void item_view_append_range(ItemView *view, guint from);
+void item_view_refilter(ItemView *view);
+void item_view_refilter_partial(ItemView *view, guint count);
+void item_view_refilter_notify(ItemView *view, guint count);
+void item_view_show_range(ItemView *view, guint from, guint to);
+void item_view_rank(ItemView *view, guint count);
+
+GArray *item_view_get_order(const ItemView *view);
+gboolean item_view_is_sorted(const ItemView *view);
+gint item_view_find_row(const ItemView *view, guint index);
+guint item_view_get_length(const ItemView *view);
+guint item_view_get_index(const ItemView *view, const GtkTreeIter *iter);
+
+#endif /* ITEM_VIEW_H */
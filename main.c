@@ -8,11 +8,26 @@
  * Main window, widgets are created and state initialized (see #Application)
  * using #new_application.
  *
- * Control is passed to GTK main event loop from which #read_items is called
- * every time the application is idle and stdin is open. This function parses
- * items from stdin. Function is interrupted after reading at most
- * #STDIN_BATCH_SIZE characters (changing value #STDIN_BATCH_SIZE may improve
- * responsiveness).
+ * Items are read from stdin in background thread (see reader.c) which
+ * splits items and passes them in batches to main event loop. Items are kept
+ * as raw bytes; special characters are escaped only when item is shown in
+ * list or inserted to entry.
+ *
+ * Control is passed to GTK main event loop. Every time new items are
+ * available, #items_available starts a frame clock tick callback which
+ * inserts items to list (#insert_items) once per frame for at most
+ * Application::frame_budget (option \c --frame-budget) so the window stays
+ * responsive while loading. If items are sorted (option \c --sort), each
+ * chunk of inserted items is merged into the list at once (#merge_items).
+ *
+ * After items are loaded, Ctrl+S switches between sort orders
+ * (#cycle_sort_order). Each order is sorted once in background and cached
+ * (see sort_order.h), so switching to it later only reorders visible rows.
+ *
+ * Items are refiltered (#refilter) in thread pool (see filter.h, option
+ * \c --threads). Main event loop only shows items which were already
+ * processed once per frame (#refilter_tick), so the window stays responsive
+ * and newer filter text aborts refiltering which is still running.
  *
  * After main event loop finishes, program prints contents of text entry and
  * exits with exit code 0 if the text was submitted. Otherwise application
@@ -28,9 +43,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
-#include <sys/select.h>
-
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "filter.h"
+#include "fm_index.h"
+#include "item_store.h"
+#include "item_view.h"
+#include "match.h"
+#include "parallel_sort.h"
+#include "reader.h"
+#include "result_cache.h"
+#include "scan.h"
+#include "sort_order.h"
+#include "trigram_index.h"
 #include "sprinter_icon.h"
 
 
@@ -59,22 +89,23 @@
 "  -1x1+0-1  Window has maximal width and minimal height and is placed at\n" \
 "            the bottom screen edge.\n"
 
-/** buffer too small error string */
-#define ERR_BUFFER_TOO_SMALL "Item text is too long (BUFSIZ is %d)!"\
-    " Try changing the input separator using option -i.\n"
+/** error string if input file cannot be opened */
+#define ERR_OPEN_FILE "Cannot open file \"%s\": %s\n"
 
 /**
- * Maximum number of characters read from input before the control is
- * returned to main event loop.
- * Other values might lead to better or worse responsiveness
- * while reading lot of data from stdin.
+ * Initial estimate of time (in microseconds) needed to insert an item.
+ * Number of items inserted at once is adjusted according to measured time.
  */
-#define STDIN_BATCH_SIZE 250
+#define INSERT_COST_ESTIMATE 1.0
 
 /** delay (in milliseconds) for list refiltering */
 #define REFILTER_DELAY 200
+/** maximum memory (in bytes) for cached filter results */
+#define RESULT_CACHE_SIZE (16 << 20)
 /** delay (in milliseconds) for selection processing */
 #define SELECT_DELAY 200
+/** number of best matching rows sorted by score in fuzzy mode */
+#define RANKED_ROWS 1000
 
 /**\{ \name Default option values */
 /** default window title */
@@ -89,20 +120,51 @@
 #define DEFAULT_WINDOW_WIDTH 230
 /** default window height */
 #define DEFAULT_WINDOW_HEIGHT 320
+/** default time (in milliseconds) spent inserting items in single frame */
+#define DEFAULT_FRAME_BUDGET 8
 /**\}*/
 
-/** columns in list store */
-enum
-{
-    /** visibility toggle */
-    COL_VISIBLE,
-    /** file icon or empty */
-    COL_ICON,
-    /** item text */
-    COL_TEXT,
-    /** number of columns */
-    NUM_COLS
-};
+/** item index types (option \c --index) */
+typedef enum {
+    /** no index (all items are scanned) */
+    INDEX_NONE,
+    /** trigram index (see trigram_index.h) */
+    INDEX_TRIGRAM,
+    /** FM-index (see fm_index.h) */
+    INDEX_FM
+} IndexType;
+
+/** statistics (printed with \c --verbose option) */
+typedef struct {
+    /** time when application started (in microseconds) */
+    gint64 start_time;
+    /** number of times main loop was woken up to insert items */
+    guint wakeups;
+    /** number of items inserted to list */
+    guint items_read;
+    /** number of frames in which items were inserted */
+    guint frames;
+    /** number of frames missed while inserting items */
+    guint missed_frames;
+    /** time of last frame in which items were inserted */
+    gint64 last_frame_time;
+    /** number of times items were refiltered */
+    guint refilters;
+    /** number of refilterings aborted by newer filter text */
+    guint aborted_refilters;
+    /** time (in microseconds) spent refiltering items */
+    gint64 refilter_time;
+    /** number of refilterings which showed results */
+    guint first_results;
+    /** time (in microseconds) from refilter requests to first results shown */
+    gint64 first_results_time;
+    /** longest time (in microseconds) to first results of refiltering */
+    gint64 max_first_results_time;
+    /** longest time (in microseconds) spent showing results in a frame */
+    gint64 max_show_time;
+    /** time (in microseconds) needed to sort all items in thread pool */
+    gint64 sort_time;
+} Statistics;
 
 /** main window, widgets and current state */
 typedef struct {
@@ -116,12 +178,12 @@ typedef struct {
     GtkTreeView *tree_view;
     /** widget for scrolling item list */
     GtkScrolledWindow *scroll_window;
-    /** list store for items */
-    GtkListStore *store;
-    /** filtered model */
-    GtkTreeModel *filtered_model;
-    /** sorted model */
-    GtkTreeModel *sorted_model;
+    /** list model for items */
+    ItemStore *store;
+    /** file icons for content types */
+    GHashTable *icons;
+    /** list model with visible (and sorted) items shown in list */
+    ItemView *view;
 
     /** Temporarily toggle auto-completion. */
     gboolean complete;
@@ -138,16 +200,85 @@ typedef struct {
     /** window height */
     gint height;
 
-    /** input separator*/
+    /** input separator (unescaped) */
     char *i_separator;
+    /** input separator length */
+    gsize i_separator_len;
     /** output separator*/
     char *o_separator;
+    /** output separator (unescaped) */
+    char *o_separator_raw;
+    /** unescaped output separator length */
+    gsize o_separator_raw_len;
+
+    /** output for entry text set by selecting items (unescaped) */
+    GByteArray *output;
+    /** entry text corresponding to Application::output */
+    gchar *output_text;
 
     /** exit code for program */
     int exit_code;
 
+    /** reader thread */
+    Reader *reader;
+    /** batch of items which is being inserted to list */
+    ItemBatch *batch;
+    /** index of next item to insert from Application::batch */
+    guint batch_pos;
+    /** tick callback inserting items (0 if not running) */
+    guint tick_id;
+    /** time (in microseconds) spent inserting items in single frame */
+    gint64 frame_budget;
+    /** measured time (in microseconds) needed to insert an item */
+    gdouble insert_cost;
+
+    /** compiled filter text (see #get_query) */
+    Query *query;
+    /** thread pool for refiltering items */
+    Filter *filter_pool;
+    /** tick callback showing refiltered items (0 if not running) */
+    guint refilter_tick_id;
+    /** number of items with refiltered visibility shown in list */
+    guint refilter_shown;
+    /** list must be rebuilt when refiltered items are shown next time */
+    gboolean refilter_rebuild;
+    /** time when current refiltering was requested (0 if results shown) */
+    gint64 refilter_request_time;
+    /** filter text of last refiltering (unescaped) */
+    gchar *last_filter_text;
+    /** visibility of items for earlier filter texts */
+    ResultCache *result_cache;
+    /** index built after items are loaded */
+    IndexType index_type;
+    /** trigram index (NULL until items are loaded) */
+    TrigramIndex *trigram_index;
+    /** FM-index (NULL until items are loaded) */
+    FmIndex *fm_index;
+    /**
+     * All items are sorted at once after they are loaded
+     * (input is mapped file, see #sort_items).
+     */
+    gboolean sort_loaded;
+    /** thread sorting all items (NULL if not running) */
+    GThread *sort_thread;
+    /** indexes of all items in sort order computed by sort thread */
+    GArray *sorted;
+    /** current sort order of list */
+    SortOrder sort;
+    /** sort order selected by user (shown after it's built) */
+    SortOrder sort_requested;
+    /** cached sort orders (NULL until items are loaded) */
+    SortOrders *orders;
+    /** time when current refiltering started */
+    gint64 refilter_start_time;
+
     /** text typed by user */
     gchar *original_text;
+
+    /** Print statistics on exit. */
+    gboolean verbose;
+    /** statistics */
+    Statistics stats;
 } Application;
 
 /** program arguments */
@@ -162,15 +293,23 @@ typedef struct {
 
 /** program options (short, long, description) */
 const Argument arguments[] = {
+    {'b', "frame-budget",      "milliseconds per frame spent inserting items"},
+    {'c', "cpu-features",      "print instruction set used for search and exit"},
+    {'f', "file",              "read items from file instead of stdin"},
     {'g', "geometry",          "window size and position"},
     {'h', "help",              "show this help"},
     {'i', "input-separator",   "string which separates items on input"},
+    {'j', "threads",           "number of threads for filtering items"},
     {'l', "label",             "text input label"},
     {'m', "minimal",           "hide list (press TAB key to show the list)"},
     {'o', "output-separator",  "string which separates items on output"},
-    {'s', "sort",              "sort items naturally"},
+    {'s', "sort",              "sort items (natural, input, length, score, recency, locale)"},
     /*{'S', "strict",            "choose only items from stdin"},*/
     {'t', "title",             "title"},
+    {'v', "verbose",           "print statistics to stderr on exit"},
+    {'x', "index",             "index items for faster filtering (trigram, fm)"},
+    {'y', "typos",             "number of typos allowed in each word"},
+    {'z', "fuzzy",             "match items fuzzily and sort them by score"},
     {'0', "zero-terminated",   "items on input are terminated with zero byte"}
 };
 
@@ -183,6 +322,16 @@ typedef struct {
     const char *title;
     /** entry label text */
     const char *label;
+    /** input file (stdin if NULL) */
+    const char *file;
+    /** time (in milliseconds) spent inserting items in single frame */
+    gint frame_budget;
+    /** number of threads for filtering items (0 for number of processors) */
+    gint threads;
+    /** index built after items are loaded */
+    IndexType index;
+    /** number of edits allowed per token (see #match_set_typos) */
+    gint typos;
 
     /**\{ \name Main window geometry */
     gint x,      /**< X position */
@@ -193,12 +342,18 @@ typedef struct {
 
     /** help requested */
     gboolean show_help;
+    /** Print selected instruction set (see #scan_init). */
+    gboolean show_cpu_features;
     /** Hide list initially (minimal mode). */
     gboolean hide_list;
-    /** \todo Sort list. */
-    gboolean sort_list;
+    /** Sort order of list. */
+    SortOrder sort;
     /** \todo If entry text submitted, check if item with same text exists. */
     gboolean strict;
+    /** Print statistics on exit. */
+    gboolean verbose;
+    /** Match items fuzzily (see #MATCH_FUZZY). */
+    gboolean fuzzy;
 
     /** input separator*/
     char *i_separator;
@@ -211,6 +366,7 @@ typedef struct {
 
 
 extern void submit(Application *app);
+extern void cycle_sort_order(Application *app);
 
 
 /** Prints help. */
@@ -234,27 +390,6 @@ void help_geometry()
     g_printerr(HELP_GEOMETRY);
 }
 
-/**
- * Find separator in bytes for \c bsearch.
- */
-const gchar *find_separator( const gchar *sep, size_t sep_len,
-                             const gchar *str, size_t len )
-{
-    int i;
-
-    if (!sep_len) {
-        return NULL;
-    }
-
-    for ( i = 0; sep_len <= len-i; ++i ) {
-        if ( memcmp(sep, str+i, sep_len) == 0 ) {
-            return str+i;
-        }
-    }
-
-    return NULL;
-}
-
 /**
  * Unescapes string.
  * Since the result can contain multiple \0 characters,
@@ -334,6 +469,33 @@ gchar *escape(const gchar *str)
     return result;
 }
 
+/**
+ * Appends escaped item text to \a str.
+ * Escapes \a len bytes of \a text (backslash, new line, tab and zero
+ * characters) so the result can be reverted with #unescape.
+ */
+void append_escaped(GString *str, const gchar *text, gsize len)
+{
+    const gchar *s, *end = text + len, *start = text;
+
+    for ( s = text; s < end; ++s ) {
+        if ( *s == '\\' || *s == '\n' || *s == '\t' || *s == '\0' ) {
+            g_string_append_len(str, start, s - start);
+            g_string_append_c(str, '\\');
+            if (*s == '\\')
+                g_string_append_c(str, '\\');
+            else if (*s == '\n')
+                g_string_append_c(str, 'n');
+            else if (*s == '\t')
+                g_string_append_c(str, 't');
+            else
+                g_string_append_c(str, '0');
+            start = s + 1;
+        }
+    }
+    g_string_append_len(str, start, end - start);
+}
+
 /**
  * Creates options for application.
  * Creates \a options and sets it accordingly to arguments passed to program.
@@ -342,16 +504,24 @@ Options new_options(int argc, char *argv[])
 {
     int w, h, x, y;
     gboolean force_arg;
-    char *argp;
+    char *argp, *value;
     char c, arg;
     int i, j, len;
+    size_t optlen;
     Options options;
 
     /* default options */
     options.title = DEFAULT_TITLE;
     options.label = DEFAULT_LABEL;
-    options.show_help = options.hide_list =
-        options.sort_list = options.strict = FALSE;
+    options.file = NULL;
+    options.frame_budget = DEFAULT_FRAME_BUDGET;
+    options.threads = 0;
+    options.index = INDEX_NONE;
+    options.sort = SORT_INPUT;
+    options.typos = 0;
+    options.show_help = options.show_cpu_features = options.hide_list =
+        options.strict = options.verbose =
+        options.fuzzy = FALSE;
     options.x = options.y = OPTION_UNSET;
     options.width  = DEFAULT_WINDOW_WIDTH;
     options.height = DEFAULT_WINDOW_HEIGHT;
@@ -374,14 +544,23 @@ Options new_options(int argc, char *argv[])
         j = 0;
         force_arg = FALSE;
 
-        /* long option */
+        /* long option (value can follow after '=') */
         if (argp[1] == '-') {
             argp += 2;
+            value = strchr(argp, '=');
+            optlen = value ? (size_t)(value - argp) : strlen(argp);
             for ( ; j<len; ++j) {
-                if ( strcmp(argp, arguments[j].opt) == 0 )
+                if ( strncmp(argp, arguments[j].opt, optlen) == 0 &&
+                     arguments[j].opt[optlen] == '\0' )
                     break;
             }
-            argp = i<argc ? argv[i] : NULL;
+            if (value) {
+                argp = value + 1;
+                force_arg = TRUE;
+                --i;
+            } else {
+                argp = i<argc ? argv[i] : NULL;
+            }
         }
         /* short option */
         else {
@@ -408,7 +587,25 @@ Options new_options(int argc, char *argv[])
         /* set options */
         arg = arguments[j].shopt;
         j = i;
-        if (arg == 'g') {
+        if (arg == 'b') {
+            if ( !argp || sscanf(argp, "%d%c", &w, &c) != 1 || w <= 0 ) {
+                help();
+                options.ok = FALSE;
+                break;
+            }
+            ++i;
+            options.frame_budget = w;
+        } else if (arg == 'c') {
+            options.show_cpu_features = TRUE;
+        } else if (arg == 'f') {
+            if (!argp) {
+                help();
+                options.ok = FALSE;
+                break;
+            }
+            ++i;
+            options.file = argp;
+        } else if (arg == 'g') {
             if (!argp) {
                 help_geometry();
                 options.ok = FALSE;
@@ -459,6 +656,14 @@ Options new_options(int argc, char *argv[])
             }
             ++i;
             options.i_separator = escape(argp);
+        } else if (arg == 'j') {
+            if ( !argp || sscanf(argp, "%d%c", &w, &c) != 1 || w <= 0 ) {
+                help();
+                options.ok = FALSE;
+                break;
+            }
+            ++i;
+            options.threads = w;
         } else if (arg == 'l') {
             if (!argp) {
                 help();
@@ -478,9 +683,29 @@ Options new_options(int argc, char *argv[])
             ++i;
             options.o_separator = escape(argp);
         } else if (arg == 's') {
-            options.sort_list = TRUE;
+            /* sort order can be only passed as "--sort=ORDER" or "-sORDER" */
+            options.sort = SORT_NATURAL;
+            if (force_arg) {
+                if ( !sort_order_from_name(argp, &options.sort) ) {
+                    help();
+                    options.ok = FALSE;
+                    break;
+                }
+                ++i;
+            }
         } else if (arg == 'S') {
             options.strict = TRUE;
+        } else if (arg == 'x') {
+            if ( argp && strcmp(argp, "trigram") == 0 ) {
+                options.index = INDEX_TRIGRAM;
+            } else if ( argp && strcmp(argp, "fm") == 0 ) {
+                options.index = INDEX_FM;
+            } else {
+                help();
+                options.ok = FALSE;
+                break;
+            }
+            ++i;
         } else if (arg == 't') {
             if (!argp) {
                 help();
@@ -489,6 +714,18 @@ Options new_options(int argc, char *argv[])
             }
             ++i;
             options.title = argp;
+        } else if (arg == 'v') {
+            options.verbose = TRUE;
+        } else if (arg == 'y') {
+            if ( !argp || sscanf(argp, "%d%c", &w, &c) != 1 || w < 0 ) {
+                help();
+                options.ok = FALSE;
+                break;
+            }
+            ++i;
+            options.typos = w;
+        } else if (arg == 'z') {
+            options.fuzzy = TRUE;
         } else if (arg == '0') {
             options.i_separator = "\\0";
         } else {
@@ -578,6 +815,14 @@ gboolean on_key_press(GtkWidget *widget, GdkEvent *event, Application *app)
             case GDK_KEY_Return:
                 submit(app);
                 return TRUE;
+            /** If Ctrl+S pressed, switch to next sort order. */
+            case GDK_KEY_s:
+            case GDK_KEY_S:
+                if (event->key.state & GDK_CONTROL_MASK) {
+                    cycle_sort_order(app);
+                    return TRUE;
+                }
+                break;
         }
     }
 
@@ -673,100 +918,59 @@ gboolean entry_on_key_press( GtkWidget *widget,
 }
 
 /**
- * file icon
- * \return file icon if file with path \a filename exists, NULL otherwise
+ * File icon.
+ * Icons are added to item store once for each content type
+ * (see Application::icons).
+ * \return icon index in item store for interned \a content_type,
+ * 0 if \a content_type is NULL or icon is not available
  */
-GdkPixbuf *pixbuf_from_file(const gchar *filename)
+guint icon_from_content_type( const gchar *content_type,
+                              Application *app )
 {
     GdkPixbuf *pixbuf = NULL;
-    GFile *file = g_file_new_for_path(filename);
-    GtkIconTheme *icon_theme = gtk_icon_theme_get_default();
-
-    if (file) {
-        GFileInfo *info =
-            g_file_query_info( file, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
-                               G_FILE_QUERY_INFO_NONE, NULL, NULL );
-        if (info) {
-            GIcon *mime_icon =
-                g_content_type_get_icon( g_file_info_get_content_type(info) );
-            if (mime_icon) {
-                GtkIconInfo *icon_info =
-                    gtk_icon_theme_lookup_by_gicon( icon_theme, mime_icon, 16,
-                                                    GTK_ICON_LOOKUP_USE_BUILTIN );
-                if (icon_info) {
-                    pixbuf = gtk_icon_info_load_icon(icon_info, NULL);
-                    gtk_icon_info_free(icon_info);
-                }
-                g_object_unref(mime_icon);
-            }
-            g_object_unref(info);
-        }
-        g_object_unref(file);
-    }
-
-    return pixbuf;
-}
-
-/**
- * Match tokens.
- * Find all tokens (space separated strings in \a needle) in given order in
- * \a haystack cropped to \a max characters.
- * Search is case insensitive.
- * \return pointer to first matched substring in \a haystack, NULL if not found
- */
-const gchar *match_tokens(const gchar *haystack, const gchar *needle)
-{
-    const gchar *h, *hh, *nn;
+    GtkIconTheme *icon_theme;
+    GIcon *mime_icon;
+    gpointer icon;
 
-    if ( !*needle )
-        return haystack;
+    if (!content_type)
+        return 0;
 
-    for ( h = haystack; *h; ++h ) {
-        for ( hh = h, nn = needle; *hh && *nn; ++hh, ++nn ) {
-            if ( *nn == ' ' ) {
-                if ( match_tokens(hh, nn+1) )
-                    return h;
-                else
-                    break;
-            } else if ( toupper(*hh) != toupper(*nn) ) {
-                break;
-            }
+    if ( g_hash_table_lookup_extended(app->icons, content_type,
+                                      NULL, &icon) )
+        return GPOINTER_TO_UINT(icon);
+
+    icon_theme = gtk_icon_theme_get_default();
+    mime_icon = g_content_type_get_icon(content_type);
+    if (mime_icon) {
+        GtkIconInfo *icon_info =
+            gtk_icon_theme_lookup_by_gicon( icon_theme, mime_icon, 16,
+                                            GTK_ICON_LOOKUP_USE_BUILTIN );
+        if (icon_info) {
+            pixbuf = gtk_icon_info_load_icon(icon_info, NULL);
+            gtk_icon_info_free(icon_info);
         }
-        if (!*nn)
-            return h;
+        g_object_unref(mime_icon);
     }
-    return NULL;
+    icon = GUINT_TO_POINTER( item_store_add_icon(app->store, pixbuf) );
+    if (pixbuf)
+        g_object_unref(pixbuf);
+    g_hash_table_insert(app->icons, (gpointer)content_type, icon);
+
+    return GPOINTER_TO_UINT(icon);
 }
 
-/**
- * Insert item to store.
- * Creates new row with \a text and icon (\a pixbuf) in \a store
- * at position given by \a iter.
- * Row will be hidden if \a visible is FALSE.
- * If \a text is filename or path to existing file, an icon is created.
- */
-void insert_item( GtkTreeIter *iter,
-                  const gchar *text,
-                  GdkPixbuf *pixbuf,
-                  gboolean visible,
-                  GtkListStore *store )
+/** Returns item in list row given by \a iter. */
+const Item *get_item(GtkTreeIter *iter, const Application *app)
 {
-    gtk_list_store_append(store, iter);
-    gtk_list_store_set( store, iter,
-            COL_VISIBLE, visible,
-            COL_ICON, pixbuf,
-            COL_TEXT, text,
-            -1 );
-
-    if (pixbuf)
-        g_object_unref(pixbuf);
+    return item_store_get_item( app->store,
+                                item_view_get_index(app->view, iter) );
 }
 
 /**
  * Returns filter text and selection bounds.
  * Filter text is last output item without characters after
  * text cursor or within and after selected text region.
- * \returns filter text
+ * \returns filter text (unescaped, to match raw item texts)
  */
 gchar *get_filter_text(gint *from, gint *to, Application *app)
 {
@@ -774,6 +978,8 @@ gchar *get_filter_text(gint *from, gint *to, Application *app)
     gchar *sep = app->o_separator;
     size_t sep_len;
     const gchar *a;
+    gchar *text, *result;
+    gsize len;
 
     gtk_editable_get_selection_bounds(GTK_EDITABLE(app->entry), from, to);
     if (*from == *to)
@@ -788,219 +994,497 @@ gchar *get_filter_text(gint *from, gint *to, Application *app)
         }
     }
 
-    return g_strndup(filter_text, *from);
+    text = g_strndup(filter_text, *from);
+    result = unescape(text, &len);
+    g_free(text);
+
+    return result;
 }
 
 /**
- * Appends item to list.
- * \callgraph
+ * Returns compiled \a filter_text.
+ * Query is compiled only if filter text changed since last call.
  */
-void append_item(char *text, Application *app)
+const Query *get_query(const gchar *filter_text, Application *app)
+{
+    if ( !app->query || strcmp(app->query->needle, filter_text) != 0 ) {
+        query_free(app->query);
+        app->query = query_new(filter_text);
+    }
+
+    return app->query;
+}
+
+/**
+ * Moves cursor to the first row if cursor is not set
+ * (in-line completion).
+ */
+void set_cursor_if_unset(Application *app)
 {
-    gboolean visible;
-    int from, to;
-    GtkTreeIter iter;
-    gchar *filter_text;
     GtkTreePath *path;
 
-    filter_text = get_filter_text(&from, &to, app);
-    app->complete &= from == to;
+    gtk_tree_view_get_cursor( app->tree_view, &path, NULL);
+    if (path) {
+        gtk_tree_path_free(path);
+    } else {
+        path = gtk_tree_path_new_first();
+        gtk_tree_view_set_cursor( app->tree_view, path,
+                NULL, FALSE );
+        gtk_tree_path_free(path);
+    }
+}
+
+/**
+ * Appends item with \a text of length \a len, sort \a key and \a icon
+ * to list.
+ * Row will be hidden if \a visible is FALSE.
+ * If \a complete is TRUE, visible item can be used for in-line completion.
+ *
+ * Items in sorted list are only added to store; they are shown in batch
+ * by #merge_items.
+ */
+void append_item( const gchar *text,
+                  gsize len,
+                  const gchar *key,
+                  guint icon,
+                  gboolean visible,
+                  gboolean complete,
+                  Application *app )
+{
+    guint index = item_store_append( app->store, text, len, key,
+                                     icon, visible );
 
-    visible = match_tokens(text, filter_text) != NULL;
+    if ( item_view_is_sorted(app->view) )
+        return;
 
-    /* append new item */
-    insert_item(&iter, text, pixbuf_from_file(text), visible, app->store);
+    item_view_append(app->view, index);
 
-    /**
-     * Does in-line completion only for last output item and only if:
-     * - no text in entry is selected and
-     * - text cursor is at the end of entry and
-     * - Application::complete is \c TRUE.
-     */
-    if ( app->complete && visible && !app->filter_timer &&
-            gtk_entry_get_text_length(app->entry) == to ) {
-        gtk_tree_view_get_cursor( app->tree_view, &path, NULL);
-        if (path) {
-            gtk_tree_path_free(path);
-        } else {
-            path = gtk_tree_path_new_first();
-            gtk_tree_view_set_cursor( app->tree_view, path,
-                    NULL, FALSE );
-        }
+    if (complete && visible)
+        set_cursor_if_unset(app);
+}
+
+/**
+ * Shows items added to sorted list since item \a from.
+ * New items are merged into the list in single step; list view is notified
+ * only about new visible rows, so scroll position and cursor don't change.
+ * If \a complete is TRUE, visible items can be used for in-line completion.
+ */
+void merge_items(guint from, gboolean complete, Application *app)
+{
+    guint len = item_view_get_length(app->view);
+
+    item_view_append_range(app->view, from);
+
+    if ( complete && item_view_get_length(app->view) > len )
+        set_cursor_if_unset(app);
+}
+
+/**
+ * Moves best fuzzy matches to the top of list: all rows if list is sorted
+ * by score, otherwise only RANKED_ROWS best rows.
+ * Visibility of all items must be refiltered.
+ */
+void rank_items(Application *app)
+{
+    if ( !app->query || app->query->mode != MATCH_FUZZY ||
+         !*app->query->needle )
+        return;
+
+    item_view_rank( app->view,
+                    app->sort == SORT_SCORE ? G_MAXUINT : RANKED_ROWS );
+}
+
+/**
+ * Shows items from first \a progress items with refiltered visibility
+ * (items refiltered so far, see #refilter_tick).
+ *
+ * List is rebuilt only when first results of refiltering are shown;
+ * afterwards only rows refiltered since last frame are inserted.
+ */
+void show_refiltered(guint progress, Application *app)
+{
+    GtkTreeModel *model;
+    gint64 time = g_get_monotonic_time();
+
+    if (app->refilter_rebuild) {
+        /**
+         * List model is detached from list view while the list is rebuilt
+         * so list view doesn't process change of each row.
+         */
+        model = g_object_ref( gtk_tree_view_get_model(app->tree_view) );
+        gtk_tree_view_set_model(app->tree_view, NULL);
+
+        item_view_refilter_partial(app->view, progress);
+
+        gtk_tree_view_set_model(app->tree_view, model);
+        gtk_tree_view_set_search_column(app->tree_view, COL_TEXT);
+        g_object_unref(model);
+        app->refilter_rebuild = FALSE;
+    } else {
+        item_view_show_range(app->view, app->refilter_shown, progress);
+    }
+    app->refilter_shown = progress;
+
+    /* best fuzzy matches are shown first when all items are scored */
+    if ( progress >= item_store_get_length(app->store) )
+        rank_items(app);
+
+    if (app->refilter_request_time) {
+        ++app->stats.first_results;
+        app->stats.first_results_time += time - app->refilter_request_time;
+        app->stats.max_first_results_time = MAX(
+            app->stats.max_first_results_time,
+            time - app->refilter_request_time );
+        app->refilter_request_time = 0;
     }
+    app->stats.max_show_time = MAX( app->stats.max_show_time,
+                                    g_get_monotonic_time() - time );
+}
 
-    g_free(filter_text);
+/**
+ * Shows items sorted in background (see #sort_items).
+ * Sort order is replaced in single step; list view is notified about
+ * removed and inserted rows so list model stays attached.
+ * \return FALSE (callback is removed from main event loop)
+ */
+gboolean items_sorted(Application *app)
+{
+    g_thread_join(app->sort_thread);
+    app->sort_thread = NULL;
+
+    item_view_set_order(app->view, app->sorted);
+    app->sorted = NULL;
+
+    /* items which are being refiltered stay hidden (see #refilter_tick) */
+    item_view_refilter_notify( app->view, app->refilter_tick_id
+                               ? app->refilter_shown
+                               : item_store_get_length(app->store) );
+    if (!app->refilter_tick_id)
+        rank_items(app);
+    if ( app->complete && item_view_get_length(app->view) )
+        set_cursor_if_unset(app);
+
+    return FALSE;
 }
 
 /**
- * Read items from standard input.
- * After at most #STDIN_BATCH_SIZE characters read from stdin passes control
- * back to main event loop.
- * If the whole input is read at once the application may be unresponsive for
- * some time.
- * \return TRUE if no error occurred and input isn't at end
- * \callgraph
+ * Sorts all items in thread pool (in background thread).
+ * Sorted items are shown by #items_sorted called from main event loop.
  */
-gboolean read_items(Application *app)
+gpointer sort_items(Application *app)
 {
-    static gchar buf[BUFSIZ];
-    static gchar *bufp = buf;
-    static struct timeval stdin_tv = {0,0};
-    fd_set stdin_fds;
-    int i, j, c;
-    const gchar *sep = app->i_separator;
-    gchar *xsep;
-    size_t sep_len = strlen(sep);
-
-    /* disable stdin buffering (otherwise select waits on new line) */
-    setbuf(stdin, NULL);
-
-    /* interrupt after reading at most N characters */
-    for( i = 0; i < STDIN_BATCH_SIZE; ++i ) {
-        /* check if data available */
-        FD_ZERO(&stdin_fds);
-        FD_SET(STDIN_FILENO, &stdin_fds);
-        if ( select(STDIN_FILENO+1, &stdin_fds, NULL, NULL, &stdin_tv) <= 0 )
-            break;
+    gint64 start = g_get_monotonic_time();
+    guint i, len = item_store_get_length(app->store);
+    GArray *order = g_array_sized_new( FALSE, FALSE, sizeof(guint), len );
 
-        /* read data */
-        if ( (c = getchar()) != EOF ) {
-            /* escape */
-            switch(c) {
-                case '\\':
-                    *bufp = '\\';
-                    *++bufp = '\\';
-                    break;
-                case '\n':
-                    *bufp = '\\';
-                    *++bufp = 'n';
-                    break;
-                case '\t':
-                    *bufp = '\\';
-                    *++bufp = 't';
-                    break;
-                case '\0':
-                    *bufp = '\\';
-                    *++bufp = '0';
-                    break;
-                default:
-                    *bufp = c;
-            }
-            ++bufp;
-
-            /* is separator? */
-            xsep = bufp-sep_len;
-            if (sep_len && xsep >= buf) {
-                /* skip first escaped char if any */
-                for (j = 1; xsep >= buf+j && *(xsep-j) == '\\'; ++j);
-                if ( !(j&1) ) ++xsep;
-
-                *bufp = 0;
-                if ( strcmp(sep, xsep) == 0 ) {
-                    *xsep = 0;
-                    bufp = buf;
-
-                    /* append new item if not empty */
-                    if (buf[0])
-                        append_item(buf, app);
-                }
-            }
+    for ( i = 0; i < len; ++i )
+        g_array_append_val(order, i);
+    parallel_sort( (guint *)order->data, len,
+                   sort_order_get_compare(app->sort), app->store,
+                   filter_get_threads(app->filter_pool) );
 
-            if ( bufp+3 >= &buf[BUFSIZ] ) {
-                /** \bug Doesn't handle buffer overflow. */
-                g_printerr(ERR_BUFFER_TOO_SMALL, BUFSIZ);
-                app->exit_code = 2;
-                gtk_main_quit();
-                return FALSE;
-            }
-        } else {
-            break;
-        }
+    app->sorted = order;
+    app->stats.sort_time = g_get_monotonic_time() - start;
+    g_idle_add( (GSourceFunc)items_sorted, app );
+
+    return NULL;
+}
+
+/**
+ * Called after all items are inserted to list.
+ * Starts building item index and sorting items in background if requested.
+ */
+void items_loaded(Application *app)
+{
+    app->orders = sort_orders_new( app->store, app->sort,
+                                   filter_get_threads(app->filter_pool) );
+
+    if (app->sort_loaded) {
+        app->sort_thread = g_thread_new( "sort",
+                                         (GThreadFunc)sort_items, app );
     }
 
-    if ( ferror(stdin) || feof(stdin) ) {
-        /* insert last item */
-        *bufp = 0;
-        if (buf[0])
-            append_item(buf, app);
+    if (app->index_type == INDEX_TRIGRAM)
+        app->trigram_index = trigram_index_new(app->store);
+    else if (app->index_type == INDEX_FM)
+        app->fm_index = fm_index_new(app->store);
+}
+
+/** Shows current sort order in tooltip of list. */
+void update_sort_tooltip(Application *app)
+{
+    gchar *tooltip = g_strdup_printf( "Sort order: %s (Ctrl+S to change)",
+                                      sort_order_get_name(app->sort) );
+
+    gtk_widget_set_tooltip_text( GTK_WIDGET(app->tree_view), tooltip );
+    g_free(tooltip);
+}
+
+/**
+ * Shows list in sort order selected by user if the order is already built
+ * (otherwise starts building it in background and is called again after
+ * it's built).
+ * Visible rows are reordered in single step while list model is detached
+ * from list view.
+ * \return FALSE (callback is removed from main event loop)
+ */
+gboolean apply_sort_order(Application *app)
+{
+    GtkTreeModel *model;
+    const guint *ranks;
+    GArray *order;
+
+    if (app->sort == app->sort_requested)
+        return FALSE;
+
+    order = sort_orders_get(app->orders, app->sort_requested, &ranks);
+    if (!order) {
+        /* if other order is being built, this is called after it's done */
+        sort_orders_build( app->orders, app->sort_requested,
+                           (GSourceFunc)apply_sort_order, app );
         return FALSE;
-    } else {
-        return TRUE;
     }
+
+    model = g_object_ref( gtk_tree_view_get_model(app->tree_view) );
+    gtk_tree_view_set_model(app->tree_view, NULL);
+
+    item_view_reorder(app->view, order, ranks);
+    app->sort = app->sort_requested;
+    /* items which are being refiltered are ranked after refiltering */
+    if (!app->refilter_tick_id)
+        rank_items(app);
+
+    gtk_tree_view_set_model(app->tree_view, model);
+    gtk_tree_view_set_search_column(app->tree_view, COL_TEXT);
+    g_object_unref(model);
+
+    if ( app->complete && item_view_get_length(app->view) )
+        set_cursor_if_unset(app);
+    update_sort_tooltip(app);
+
+    return FALSE;
 }
 
-/** Compare two items in model. */
-gint natural_compare( GtkTreeModel *model,
-                      GtkTreeIter *a,
-                      GtkTreeIter *b,
-                      gpointer user_data )
+/**
+ * Switches list to next sort order.
+ * Current order of list is cached so switching back to it is fast.
+ * Orders can be switched only after all items are loaded and sorted.
+ * Order by score is skipped unless items are matched fuzzily.
+ */
+void cycle_sort_order(Application *app)
 {
-    gchar *item1, *item2, *aa, *bb;
-    int num1, num2;
-    gint result = 0;
-
-    gtk_tree_model_get(model, a, COL_TEXT, &item1, -1);
-    gtk_tree_model_get(model, b, COL_TEXT, &item2, -1);
-
-    for( aa = item1, bb = item2; *aa && *bb; ++aa, ++bb ) {
-        if ( isdigit(*aa) && isdigit(*bb) ) {
-            sscanf(aa, "%d%s", &num1, aa);
-            sscanf(bb, "%d%s", &num2, bb);
-            if (num1 != num2) {
-                result = num1 - num2;
+    GArray *order = item_view_get_order(app->view);
+    const guint *ranks;
+
+    if ( !app->orders || app->sort_thread )
+        return;
+
+    if ( order && !sort_orders_get(app->orders, app->sort, &ranks) )
+        sort_orders_set( app->orders, app->sort, g_array_ref(order) );
+
+    app->sort_requested = (app->sort_requested + 1) % NUM_SORT_ORDERS;
+    /* order by score is the same as input order unless matching fuzzily */
+    if ( app->sort_requested == SORT_SCORE &&
+         (!app->query || app->query->mode != MATCH_FUZZY) )
+        app->sort_requested = (app->sort_requested + 1) % NUM_SORT_ORDERS;
+    apply_sort_order(app);
+}
+
+/**
+ * Returns function which finds items that can match \a query in item index
+ * and sets \a index (see #filter_start_candidates).
+ * \returns NULL if items are not indexed or the index can't be used for
+ * the query
+ */
+FilterFindFunc find_candidates( const Query *query,
+                                gpointer *index,
+                                Application *app )
+{
+    /* indexes find only exact tokens */
+    if ( query->mode != MATCH_EXACT || query->typos )
+        return NULL;
+
+    if ( app->trigram_index && trigram_index_is_ready(app->trigram_index) ) {
+        *index = app->trigram_index;
+        return (FilterFindFunc)trigram_index_find;
+    }
+
+    if ( app->fm_index && fm_index_is_ready(app->fm_index) ) {
+        *index = app->fm_index;
+        return (FilterFindFunc)fm_index_find;
+    }
+
+    return NULL;
+}
+
+/**
+ * Inserts at most \a count items read by reader thread to list.
+ * Visibility of items is re-evaluated if it was evaluated by reader thread
+ * with other than \a filter_text (filter text of last refiltering, so
+ * visibility of all items corresponds to the same text).
+ * \return number of inserted items (less than \a count if no more items are
+ * available)
+ */
+guint insert_item_records( const gchar *filter_text,
+                           gboolean complete,
+                           guint count,
+                           Application *app )
+{
+    ItemBatch *batch;
+    const ItemRecord *record;
+    const Query *query = NULL;
+    gboolean rematch, visible;
+    guint i;
+
+    for ( i = 0; i < count; ) {
+        if (!app->batch) {
+            app->batch = reader_pop(app->reader);
+            app->batch_pos = 0;
+            if (!app->batch)
                 break;
-            }
-        } else if (*aa != *bb) {
-            result = *aa - *bb;
-            break;
         }
-    }
+        batch = app->batch;
+
+        /* item visibility was evaluated with other filter text */
+        rematch = strcmp(batch->filter_text, filter_text) != 0;
+        if (rematch && !query)
+            query = get_query(filter_text, app);
+
+        for ( ; app->batch_pos < batch->records->len && i < count;
+                ++app->batch_pos, ++i ) {
+            record = &g_array_index(batch->records, ItemRecord, app->batch_pos);
+            visible = rematch
+                ? match_query(query, record->text, record->len) != NULL
+                : record->visible;
+            append_item( record->text, record->len, record->key,
+                         icon_from_content_type(record->content_type, app),
+                         visible, complete, app );
+            ++app->stats.items_read;
+        }
 
-    if (!result && *aa != *bb) {
-        result = *aa - *bb;
+        if (app->batch_pos == batch->records->len) {
+            if (batch->last)
+                items_loaded(app);
+            item_batch_free(batch);
+            app->batch = NULL;
+        }
     }
 
-    g_free(item1);
-    g_free(item2);
+    return i;
+}
 
-    return result;
+/**
+ * Inserts items read by reader thread to list.
+ * Inserts items for at most Application::frame_budget microseconds.
+ * Items are inserted in chunks; size of a chunk is computed from measured
+ * time needed to insert an item (Application::insert_cost) so that the
+ * chunk takes about half of the remaining time.
+ * \return TRUE if there can be more items available
+ * \callgraph
+ */
+gboolean insert_items(Application *app)
+{
+    gchar *filter_text;
+    gboolean complete;
+    gint64 now, chunk_start, deadline;
+    guint count, inserted, first;
+    gboolean merge = item_view_is_sorted(app->view) && !app->sort_loaded;
+    int from, to;
+
+    filter_text = get_filter_text(&from, &to, app);
+    app->complete &= from == to;
+
+    /**
+     * Does in-line completion only for last output item and only if:
+     * - no text in entry is selected and
+     * - text cursor is at the end of entry and
+     * - Application::complete is \c TRUE.
+     */
+    complete = app->complete && !app->filter_timer &&
+        gtk_entry_get_text_length(app->entry) == to;
+
+    now = g_get_monotonic_time();
+    deadline = now + app->frame_budget;
+    do {
+        chunk_start = now;
+        first = item_store_get_length(app->store);
+        count = 1 + (deadline - now) / 2 / app->insert_cost;
+        inserted = insert_item_records( app->last_filter_text, complete,
+                                        count, app );
+        /* merging is part of insert cost */
+        if (merge)
+            merge_items(first, complete, app);
+        now = g_get_monotonic_time();
+
+        if (inserted) {
+            app->insert_cost = ( app->insert_cost +
+                    (gdouble)MAX(now - chunk_start, 1) / inserted ) / 2;
+        }
+    } while ( inserted == count && now < deadline );
+
+    g_free(filter_text);
+
+    return inserted == count;
 }
 
 /**
- * Create filtered model from \a model.
- * Items are filtered using #COL_VISIBLE column.
+ * Tick callback which inserts items to list once per frame.
+ * Counts frames missed since last call (Statistics::missed_frames).
+ * \return FALSE to remove the callback if no more items are available
  */
-GtkTreeModel *create_filtered_model(GtkTreeModel *model)
+gboolean insert_items_tick( GtkWidget *widget,
+                            GdkFrameClock *frame_clock,
+                            gpointer user_data )
 {
-    GtkTreeModel *filtered;
+    Application *app = (Application *)user_data;
+    Statistics *stats = &app->stats;
+    gint64 frame_time, interval;
+
+    frame_time = gdk_frame_clock_get_frame_time(frame_clock);
+    gdk_frame_clock_get_refresh_info(frame_clock, frame_time, &interval, NULL);
+    if ( stats->last_frame_time && interval > 0 ) {
+        stats->missed_frames += MAX( 0,
+                (frame_time - stats->last_frame_time + interval / 2)
+                / interval - 1 );
+    }
+    stats->last_frame_time = frame_time;
+    ++stats->frames;
+
+    /* store must not change while items are refiltered */
+    if (app->refilter_tick_id)
+        return TRUE;
 
-    filtered = gtk_tree_model_filter_new(model, NULL);
-    gtk_tree_model_filter_set_visible_column( GTK_TREE_MODEL_FILTER(filtered),
-                                              COL_VISIBLE );
+    if ( insert_items(app) )
+        return TRUE;
 
-    return filtered;
+    app->tick_id = 0;
+    return FALSE;
 }
 
 /**
- * Create sorteded model from \a model.
- * Items are sorted using #COL_TEXT column.
+ * Called from main event loop if new items are available.
+ * Starts tick callback (#insert_items_tick) if it's not already running.
+ * \return FALSE (callback is removed from main event loop)
  */
-GtkTreeModel *create_sorted_model(GtkTreeModel *model)
+gboolean items_available(Application *app)
 {
-    GtkTreeModel *sorted;
+    ++app->stats.wakeups;
 
-    sorted = gtk_tree_model_sort_new_with_model(model);
-    gtk_tree_sortable_set_sort_func( GTK_TREE_SORTABLE(sorted), COL_TEXT,
-                                     natural_compare, NULL, NULL );
-    gtk_tree_sortable_set_sort_column_id( GTK_TREE_SORTABLE(sorted), COL_TEXT,
-                                          GTK_SORT_ASCENDING );
+    if (!app->tick_id) {
+        app->stats.last_frame_time = 0;
+        app->tick_id = gtk_widget_add_tick_callback( GTK_WIDGET(app->window),
+                                                     insert_items_tick,
+                                                     app, NULL );
+    }
 
-    return sorted;
+    return FALSE;
 }
 
 /**
  * Appends item to entry.
  * Items are separated by output separator (Application::o_separator).
+ * Item text is escaped in entry and appended unescaped to
+ * Application::output.
  */
 void append_item_text( GtkTreeModel *model,
                        GtkTreePath *path,
@@ -1010,19 +1494,27 @@ void append_item_text( GtkTreeModel *model,
     Application *app = (Application *)user_data;
     GtkEntry *entry = app->entry;
     GtkEditable *editable = GTK_EDITABLE(entry);
-    gchar *item;
+    const Item *item = get_item(iter, app);
+    static GString *text = NULL;
     gint pos;
 
-    gtk_tree_model_get(model, iter, COL_TEXT, &item, -1);
+    if (!text)
+        text = g_string_new(NULL);
+    g_string_truncate(text, 0);
+    append_escaped(text, item->text, item->len);
+
     /**
      * \bug Separator with new line character (\\n)
      * doesn't show correctly in entry.
      */
     pos = gtk_editable_get_position(editable);
-    if ( gtk_entry_get_text_length(entry) )
+    if ( gtk_entry_get_text_length(entry) ) {
         gtk_editable_insert_text(editable, app->o_separator ? app->o_separator : "", -1, &pos);
-    gtk_editable_insert_text(editable, item, -1, &pos);
-    g_free(item);
+        g_byte_array_append( app->output, (const guint8 *)app->o_separator_raw,
+                             app->o_separator_raw_len );
+    }
+    gtk_editable_insert_text(editable, text->str, text->len, &pos);
+    g_byte_array_append(app->output, (const guint8 *)item->text, item->len);
 }
 
 /**
@@ -1035,6 +1527,8 @@ void selection_changed( Application *app )
     const gchar *a, *b;
     gint sep_len = 0;
     const gchar *text;
+    gchar *raw;
+    gsize raw_len;
 
     if (app->select_timer) {
         g_source_destroy(app->select_timer);
@@ -1066,7 +1560,13 @@ void selection_changed( Application *app )
 
     /** Changes entry text to item text. */
     gtk_entry_buffer_delete_text( gtk_entry_get_buffer(app->entry), b-text, -1);
+    raw = unescape( gtk_entry_get_text(app->entry), &raw_len );
+    g_byte_array_set_size(app->output, 0);
+    g_byte_array_append(app->output, (const guint8 *)raw, raw_len);
+    g_free(raw);
     gtk_tree_selection_selected_foreach(selection, append_item_text, app);
+    g_free(app->output_text);
+    app->output_text = g_strdup( gtk_entry_get_text(app->entry) );
 
     /** select text */
     gtk_editable_select_region( GTK_EDITABLE(app->entry),
@@ -1092,19 +1592,88 @@ void delayed_selection_changed(Application *app)
                   (GSourceFunc)selection_changed, app );
 }
 
+/**
+ * In-line auto-completion.
+ * Moves cursor to first visible item which starts with \a filter_text
+ * if Application::complete is TRUE.
+ */
+void complete_item(const gchar *filter_text, Application *app)
+{
+    GtkTreeModel *model;
+    GtkTreeIter iter;
+    const Item *item;
+    const gchar *a, *b, *end;
+
+    model = gtk_tree_view_get_model(app->tree_view);
+    if ( app->complete && gtk_tree_model_get_iter_first(model, &iter) ) {
+        do {
+            item = get_item(&iter, app);
+            for( a = item->text, end = a + item->len, b = filter_text;
+                    a < end && *b && *a == *b;
+                    ++a, ++b );
+            if (!*b) {
+                app->complete = FALSE;
+                GtkTreePath *path =
+                    gtk_tree_model_get_path(model, &iter);
+                gtk_tree_view_set_cursor( app->tree_view, path,
+                        NULL, FALSE);
+                break;
+            }
+        } while( gtk_tree_model_iter_next(model, &iter) );
+    }
+}
+
+/**
+ * Tick callback which shows results of refiltering once per frame.
+ * Items already processed by filter thread pool are shown; the rest is
+ * hidden until processed.
+ * \return FALSE to remove the callback if refiltering finished
+ */
+gboolean refilter_tick( GtkWidget *widget,
+                        GdkFrameClock *frame_clock,
+                        gpointer user_data )
+{
+    Application *app = (Application *)user_data;
+    guint progress;
+    gboolean running;
+
+    /* store doesn't change while refiltering (see #insert_items_tick) */
+    progress = filter_get_progress(app->filter_pool);
+    running = progress < item_store_get_length(app->store);
+
+    if ( progress > app->refilter_shown || !running )
+        show_refiltered(progress, app);
+
+    if (running)
+        return TRUE;
+
+    app->stats.refilter_time +=
+        g_get_monotonic_time() - app->refilter_start_time;
+    app->refilter_tick_id = 0;
+
+    complete_item(app->query->needle, app);
+
+    return FALSE;
+}
+
 /**
  * Filter items in list.
  * Show item if text in the entry matches the item's text, hide otherwise.
+ *
+ * Items are matched in filter thread pool and results are shown
+ * progressively (#refilter_tick). Refiltering which is still running is
+ * aborted.
  * \callgraph
  */
 gboolean refilter(Application *app)
 {
-    static gchar *last_filter_text = NULL;
-    GtkTreeModel *model;
-    GtkTreeIter iter;
-    gchar *item_text;
-    gchar *filter_text, *a, *b;
-    gboolean visible, filter_visible;
+    const gchar *a, *b;
+    gchar *filter_text;
+    const Query *query;
+    FilterFindFunc find;
+    gpointer index = NULL;
+    gboolean filter_visible, exact;
+    guint first, cached;
     int from, to;
 
     if (app->filter_timer) {
@@ -1112,17 +1681,9 @@ gboolean refilter(Application *app)
         app->filter_timer = NULL;
     }
 
-    if(!last_filter_text) {
-        last_filter_text = g_strdup("");
-    }
-
     filter_text = get_filter_text(&from, &to, app);
 
-    /**
-     * If last filtered text starts with \a filter_text,
-     * filter only visible items.
-     */
-    for( a = filter_text, b = last_filter_text;
+    for( a = filter_text, b = app->last_filter_text;
             *a && *b && toupper(*a) == toupper(*b);
             ++a, ++b );
     /* filter only if previous filter differs */
@@ -1130,28 +1691,65 @@ gboolean refilter(Application *app)
         gtk_tree_selection_unselect_all(
                 gtk_tree_view_get_selection(app->tree_view) );
 
-        filter_visible = !*b;
-        model = GTK_TREE_MODEL(app->store);
-        if ( gtk_tree_model_get_iter_first(model, &iter) ) {
-            do {
-                if (filter_visible) {
-                    gtk_tree_model_get( model, &iter,
-                            COL_VISIBLE, &visible, -1 );
-                    if (!visible)
-                        continue;
-                }
+        /* running pass uses query which is freed by get_query() */
+        filter_cancel(app->filter_pool);
 
-                gtk_tree_model_get(model, &iter, COL_TEXT, &item_text, -1);
-                if (item_text) {
-                    visible = match_tokens(item_text, filter_text) != NULL;
-                    gtk_list_store_set(app->store, &iter, COL_VISIBLE, visible, -1);
-                    g_free(item_text);
-                }
-            } while( gtk_tree_model_iter_next(model, &iter) );
+        /* visibility of items is final only if refiltering finished */
+        if (!app->refilter_tick_id) {
+            result_cache_add( app->result_cache, app->last_filter_text,
+                              app->store );
+        }
+
+        /**
+         * Visibility of items is restored from result for the same or
+         * shorter filter text (see result_cache.h). Items matching shorter
+         * text are matched again; result for the same text is final except
+         * for items added later (and except for scores which aren't cached).
+         * Longer tokens can have more typos, so results for shorter text
+         * are not used if typos are allowed.
+         */
+        query = get_query(filter_text, app);
+        first = 0;
+        filter_visible = !query->typos && result_cache_restore(
+                app->result_cache, filter_text, app->store, &exact, &cached );
+        if ( filter_visible && exact && query->mode == MATCH_EXACT )
+            first = cached;
+
+        /**
+         * If items are indexed, only candidates found in index are matched
+         * (unless cached result is complete). Candidates are looked up in
+         * filter thread pool.
+         */
+        find = first < item_store_get_length(app->store)
+            ? find_candidates(query, &index, app) : NULL;
+
+        if (find) {
+            filter_start_candidates( app->filter_pool, app->store, query,
+                                     filter_visible, first, find, index );
+        } else {
+            filter_start( app->filter_pool, app->store,
+                          query, filter_visible, first );
+        }
+        app->refilter_shown = 0;
+        app->refilter_rebuild = TRUE;
+        app->refilter_request_time = g_get_monotonic_time();
+
+        ++app->stats.refilters;
+        if (app->refilter_tick_id) {
+            ++app->stats.aborted_refilters;
+        } else {
+            app->refilter_start_time = g_get_monotonic_time();
+            app->refilter_tick_id =
+                gtk_widget_add_tick_callback( GTK_WIDGET(app->window),
+                                              refilter_tick, app, NULL );
         }
     }
-    g_free(last_filter_text);
-    last_filter_text = filter_text;
+    g_free(app->last_filter_text);
+    app->last_filter_text = filter_text;
+
+    /* evaluate visibility of new items in reader thread */
+    if (app->reader)
+        reader_set_filter(app->reader, filter_text);
 
     /* in-line auto-completion */
     /* complete only if text cursor is at the end of entry */
@@ -1159,28 +1757,9 @@ gboolean refilter(Application *app)
     app->complete = app->complete && from == to &&
         gtk_entry_get_text_length(app->entry) == to;
 
-    model = gtk_tree_view_get_model(app->tree_view);
-    if ( app->complete && gtk_tree_model_get_iter_first(model, &iter) ) {
-        do {
-            gtk_tree_model_get(model, &iter, COL_TEXT, &item_text, -1);
-            if (item_text) {
-                for( a = item_text, b = filter_text;
-                        *a && *b && *a == *b;
-                        ++a, ++b );
-                if (!*b) {
-                    app->complete = FALSE;
-                    GtkTreePath *path =
-                        gtk_tree_model_get_path(model, &iter);
-                    gtk_tree_view_set_cursor( app->tree_view, path,
-                            NULL, FALSE);
-                    g_free(item_text);
-                    break;
-                }
-
-                g_free(item_text);
-            }
-        } while( gtk_tree_model_iter_next(model, &iter) );
-    }
+    /* otherwise completed after refiltering finishes */
+    if (!app->refilter_tick_id)
+        complete_item(filter_text, app);
 
     return FALSE;
 }
@@ -1239,10 +1818,47 @@ void text_changed( GtkEditable *editable,
     }
 }
 
+/**
+ * Sets text for cell \a renderer from #COL_TEXT column.
+ */
+void set_item_text( GtkTreeViewColumn *col,
+                    GtkCellRenderer *renderer,
+                    GtkTreeModel *model,
+                    GtkTreeIter *iter,
+                    gpointer user_data )
+{
+    static GString *text = NULL;
+    const Item *item = get_item(iter, user_data);
+
+    /* item text is not zero-terminated and can contain any bytes */
+    if (!text)
+        text = g_string_new(NULL);
+    g_string_truncate(text, 0);
+    append_escaped(text, item->text, item->len);
+
+    g_object_set(renderer, "text", text->str, NULL);
+}
+
+/**
+ * Compares item text with \a key for interactive search in list.
+ * \returns FALSE if item text starts with \a key (case insensitive)
+ */
+gboolean search_equal( GtkTreeModel *model,
+                       gint column,
+                       const gchar *key,
+                       GtkTreeIter *iter,
+                       gpointer user_data )
+{
+    const Item *item = get_item(iter, user_data);
+    gsize len = strlen(key);
+
+    return item->len < len || g_ascii_strncasecmp(item->text, key, len) != 0;
+}
+
 /**
  * Create list view from \a model.
  */
-GtkTreeView *create_list_view(GtkTreeModel *model)
+GtkTreeView *create_list_view(GtkTreeModel *model, Application *app)
 {
     GtkTreeView *tree_view;
     GtkTreeViewColumn *col;
@@ -1265,13 +1881,14 @@ GtkTreeView *create_list_view(GtkTreeModel *model)
     /** If text is too long, display dots in middle. */
     g_object_set(renderer, "ellipsize", PANGO_ELLIPSIZE_MIDDLE, NULL);
     gtk_tree_view_column_pack_start(col, renderer, TRUE);
-    gtk_tree_view_column_set_attributes( col, renderer,
-                                         "text", COL_TEXT,
-                                         NULL );
+    /** Item texts are not copied to item store. */
+    gtk_tree_view_column_set_cell_data_func( col, renderer,
+                                             set_item_text, app, NULL );
 
     gtk_tree_view_append_column(tree_view, col);
 
     gtk_tree_view_set_search_column(tree_view, COL_TEXT);
+    gtk_tree_view_set_search_equal_func(tree_view, search_equal, app, NULL);
     gtk_tree_view_set_headers_visible(tree_view, FALSE);
 
     /**
@@ -1355,11 +1972,42 @@ Application *new_application(const Options *options)
     app->complete = TRUE;
     app->filter_timer = app->select_timer = NULL;
     app->hide_list = options->hide_list;
-    app->i_separator = options->i_separator;
+    app->i_separator = unescape(options->i_separator, &app->i_separator_len);
     app->o_separator = options->o_separator;
+    app->o_separator_raw_len = 0;
+    app->o_separator_raw = options->o_separator ?
+        unescape(options->o_separator, &app->o_separator_raw_len) : NULL;
+    app->output = g_byte_array_new();
+    app->output_text = NULL;
     app->exit_code = 1;
     app->original_text = g_strdup("");
-    app->sorted_model = NULL;
+    app->view = NULL;
+    app->query = NULL;
+    app->filter_pool = filter_new(options->threads);
+    app->refilter_tick_id = 0;
+    app->refilter_shown = 0;
+    app->refilter_rebuild = FALSE;
+    app->refilter_request_time = 0;
+    app->last_filter_text = g_strdup("");
+    app->result_cache = result_cache_new(RESULT_CACHE_SIZE);
+    app->index_type = options->index;
+    app->trigram_index = NULL;
+    app->fm_index = NULL;
+    app->sort_loaded = FALSE;
+    app->sort_thread = NULL;
+    app->sorted = NULL;
+    app->sort = app->sort_requested = options->sort;
+    app->orders = NULL;
+    app->refilter_start_time = 0;
+    app->reader = NULL;
+    app->batch = NULL;
+    app->batch_pos = 0;
+    app->tick_id = 0;
+    app->frame_budget = (gint64)options->frame_budget * 1000;
+    app->insert_cost = INSERT_COST_ESTIMATE;
+    app->verbose = options->verbose;
+    memset( &app->stats, 0, sizeof(Statistics) );
+    app->stats.start_time = g_get_monotonic_time();
 
     /** Creates: */
     /** - main window, */
@@ -1373,19 +2021,21 @@ Application *new_application(const Options *options)
     app->button = GTK_BUTTON( gtk_button_new_with_label(options->label) );
     g_object_set(app->button, "can-focus", FALSE, NULL);
 
-    /** - list store and filtered model, */
-    app->store = gtk_list_store_new( 3,
-                    G_TYPE_BOOLEAN,
-                    GDK_TYPE_PIXBUF,
-                    G_TYPE_STRING );
-    model = app->filtered_model = create_filtered_model( GTK_TREE_MODEL(app->store) );
-    if (options->sort_list) {
-        model = app->sorted_model = create_sorted_model(model);
+    /** - item store and view with visible (sorted) items, */
+    app->store = item_store_new();
+    app->icons = g_hash_table_new(g_direct_hash, g_direct_equal);
+    app->view = item_view_new(app->store);
+    if ( sort_order_get_compare(options->sort) ) {
+        item_view_set_sort_func( app->view,
+                                 sort_order_get_compare(options->sort),
+                                 app->store );
     }
+    model = GTK_TREE_MODEL(app->view);
 
     /** - list view, */
-    app->tree_view = create_list_view(model);
+    app->tree_view = create_list_view(model, app);
     g_object_unref(model);
+    update_sort_tooltip(app);
 
     /* multiple selections only if output separator set */
     if (app->o_separator) {
@@ -1468,6 +2118,7 @@ void submit(Application *app)
 {
     gsize len, len2;
     gchar *txt;
+    const gchar *text;
 
     if ( app->select_timer ) {
         selection_changed(app);
@@ -1477,15 +2128,101 @@ void submit(Application *app)
     /* data is binary */
     g_io_channel_set_encoding(out, NULL, NULL);
 
-    txt = unescape( gtk_entry_get_text(app->entry), &len );
-    g_io_channel_write_chars(out, txt, len, &len2, NULL);
+    /** If entry text was set by selecting items, writes raw item texts. */
+    text = gtk_entry_get_text(app->entry);
+    if ( app->output_text && strcmp(text, app->output_text) == 0 ) {
+        g_io_channel_write_chars( out, (const gchar *)app->output->data,
+                                  app->output->len, &len2, NULL );
+    } else {
+        txt = unescape(text, &len);
+        g_io_channel_write_chars(out, txt, len, &len2, NULL);
+        g_free(txt);
+    }
     g_io_channel_shutdown(out, TRUE, NULL);
-    g_free(txt);
 
     app->exit_code = 0;
     gtk_main_quit();
 }
 
+/** Prints memory used for items to stderr. */
+void print_memory_statistics(const Application *app)
+{
+    const Arena *arena = reader_get_arena(app->reader);
+    guint items = MAX(app->stats.items_read, 1);
+
+    g_printerr( "item text memory:  %" G_GSIZE_FORMAT " B used, %"
+                G_GSIZE_FORMAT " B allocated in %u chunks\n",
+                arena->used, arena->allocated, arena->chunks->len );
+    g_printerr( "memory per item:   %.1f B text and key, %.1f B allocated\n",
+                (gdouble)arena->used / items,
+                (gdouble)arena->allocated / items );
+    g_printerr( "sort key memory:   %" G_GSIZE_FORMAT " B, %.1f B per item\n",
+                reader_get_key_size(app->reader),
+                (gdouble)reader_get_key_size(app->reader) / items );
+    if (app->orders) {
+        g_printerr( "sort order memory: %" G_GSIZE_FORMAT " B\n",
+                    sort_orders_get_size(app->orders) );
+    }
+    g_printerr( "mapped input:      %" G_GSIZE_FORMAT " B\n",
+                reader_get_mapped_size(app->reader) );
+}
+
+/** Prints statistics to stderr. */
+void print_statistics(const Application *app)
+{
+    const Statistics *stats = &app->stats;
+    struct rusage usage;
+    gdouble wall, cpu;
+
+    getrusage(RUSAGE_SELF, &usage);
+    wall = (g_get_monotonic_time() - stats->start_time) / 1e6;
+    cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+
+    g_printerr( "items read:        %u\n", stats->items_read );
+    g_printerr( "bytes read:        %" G_GUINT64_FORMAT "\n",
+                reader_get_bytes_read(app->reader) );
+    g_printerr( "read() calls:      %u\n", reader_get_reads(app->reader) );
+    g_printerr( "wake-ups:          %u\n", stats->wakeups );
+    g_printerr( "frames:            %u (%u missed)\n",
+                stats->frames, stats->missed_frames );
+    g_printerr( "refilters:         %u (%u aborted, %.3f s, %u threads)\n",
+                stats->refilters, stats->aborted_refilters,
+                stats->refilter_time / 1e6,
+                filter_get_threads(app->filter_pool) );
+    if (stats->first_results) {
+        g_printerr( "first results:     %.1f ms avg, %.1f ms max "
+                    "(%.1f ms max per frame)\n",
+                    stats->first_results_time / 1e3 / stats->first_results,
+                    stats->max_first_results_time / 1e3,
+                    stats->max_show_time / 1e3 );
+    }
+    if ( app->trigram_index && trigram_index_is_ready(app->trigram_index) ) {
+        g_printerr( "trigram index:     %" G_GSIZE_FORMAT " B, built in %.3f s\n",
+                    trigram_index_get_size(app->trigram_index),
+                    trigram_index_get_build_time(app->trigram_index) / 1e6 );
+    }
+    if ( app->fm_index && fm_index_is_ready(app->fm_index) ) {
+        g_printerr( "FM-index:          %" G_GSIZE_FORMAT " B, built in %.3f s\n",
+                    fm_index_get_size(app->fm_index),
+                    fm_index_get_build_time(app->fm_index) / 1e6 );
+    }
+    if (app->stats.sort_time) {
+        g_printerr( "sort:              %.3f s, %u threads\n",
+                    app->stats.sort_time / 1e6,
+                    filter_get_threads(app->filter_pool) );
+    }
+    g_printerr( "result cache:      %u hits, %u prefix hits, %u misses, "
+                "%u evicted, %" G_GSIZE_FORMAT " B\n",
+                app->result_cache->hits, app->result_cache->prefix_hits,
+                app->result_cache->misses, app->result_cache->evictions,
+                app->result_cache->size );
+    print_memory_statistics(app);
+    g_printerr( "wall time:         %.3f s\n", wall );
+    g_printerr( "CPU time:          %.3f s (%.1f%%)\n",
+                cpu, wall > 0 ? 100 * cpu / wall : 0 );
+}
+
 /**
  * \callgraph
  */
@@ -1493,7 +2230,10 @@ int main(int argc, char *argv[])
 {
     Options options;
     Application *app;
-    int exit_code;
+    int fd, exit_code;
+
+    /** Selects search kernels for CPU. */
+    scan_init();
 
     /** Parses options from program arguments. */
     options = new_options(argc, argv);
@@ -1502,6 +2242,25 @@ int main(int argc, char *argv[])
         return 0;
     } else if (!options.ok) {
         return 2;
+    } else if (options.show_cpu_features) {
+        g_print( "%s\n", scan_get_variant() );
+        return 0;
+    }
+
+    /** Sets matching mode before any query is created. */
+    if (options.fuzzy)
+        match_set_mode(MATCH_FUZZY);
+    match_set_typos(options.typos);
+
+    /** Opens input file. */
+    if (options.file) {
+        fd = open(options.file, O_RDONLY);
+        if (fd == -1) {
+            g_printerr( ERR_OPEN_FILE, options.file, g_strerror(errno) );
+            return 2;
+        }
+    } else {
+        fd = STDIN_FILENO;
     }
 
     /** Initializes application and shows main window. */
@@ -1509,11 +2268,29 @@ int main(int argc, char *argv[])
 
     app = new_application(&options);
 
-    /** Starts appending lines from stdin to list store. */
-    g_idle_add( (GSourceFunc)read_items, app );
+    /**
+     * Starts reading items from input in background thread
+     * (regular files are mapped to memory).
+     */
+    app->reader = reader_new( fd,
+                              app->i_separator, app->i_separator_len,
+                              sort_order_get_key_func(options.sort),
+                              (GSourceFunc)items_available, app );
+    /**
+     * Whole mapped input is read quickly, so sorted items are shown after
+     * they are sorted at once in thread pool instead of merging them into
+     * list while loading.
+     */
+    app->sort_loaded = sort_order_get_compare(options.sort) &&
+        reader_get_mapped_size(app->reader) > 0;
+    /** Item store is presized using estimated number of items. */
+    item_store_reserve( app->store, reader_get_size_hint(app->reader) );
 
     gtk_main();
 
+    if (app->verbose)
+        print_statistics(app);
+
     exit_code = app->exit_code;
     free(app);
 
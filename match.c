@@ -0,0 +1,328 @@
+/**
+ * \file match.c
+ *
+ * Matching items with text typed by user.
+ *
+ * Filter text is compiled to #Query once (#query_new) and matched with many
+ * items (#match_query). Tokens are searched greedily from left: first
+ * occurrence of a token is the best choice for the following tokens, so no
+ * backtracking is needed. Each token is searched starting where the
+ * previous token ended.
+ *
+ * Tokens are searched with vectorized kernel (#find_caseless) which filters
+ * candidate positions by first and last byte of token. Candidates are
+ * compared with whole token only up to a limit proportional to length of
+ * item divided by length of token; after that search continues with
+ * Knuth-Morris-Pratt algorithm, so matching still takes O(n + m) time for
+ * item of length n and filter text of length m.
+ *
+ * If typos are allowed (see #match_set_typos), each token is searched with
+ * bit-parallel approximate matching (Myers' algorithm): column of edit
+ * distance matrix for token of at most 64 bytes is encoded in bit vectors
+ * of single machine word and updated with a few bit operations per byte of
+ * item. Search stops at the first end of text which differs from the token
+ * by at most allowed number of edits.
+ *
+ * In fuzzy mode (see #match_set_mode) each token is matched anywhere in item
+ * as subsequence and matches are scored (see fuzzy.h); score of item is sum
+ * of scores of its tokens.
+ *
+ * Functions in this file don't use GTK and can be called from any thread.
+ */
+#include "match.h"
+#include "fuzzy.h"
+#include "scan.h"
+
+#include <string.h>
+
+/** mode of new queries */
+MatchMode match_mode = MATCH_EXACT;
+/** maximum number of edits per token in new queries */
+guint match_typos = 0;
+
+/** maximum length of token matched with typos (bits in bit vector) */
+#define MATCH_MAX_TYPO_TOKEN 64
+
+/**
+ * Computes KMP failure function of \a token.
+ * Item \c i of result is length of the longest proper prefix of
+ * first \c i+1 bytes of \a token which is also their suffix.
+ */
+gsize *token_failure_function(const gchar *token, gsize len)
+{
+    gsize *fail = g_new(gsize, MAX(len, 1));
+    gsize i, k = 0;
+
+    fail[0] = 0;
+    for ( i = 1; i < len; ++i ) {
+        while ( k > 0 && token[i] != token[k] )
+            k = fail[k - 1];
+        if ( token[i] == token[k] )
+            ++k;
+        fail[i] = k;
+    }
+
+    return fail;
+}
+
+/**
+ * Sets matching mode of queries created afterwards.
+ * Should be called at startup before other threads are started.
+ */
+void match_set_mode(MatchMode mode)
+{
+    match_mode = mode;
+}
+
+/**
+ * Sets maximum number of edits (inserted, deleted or substituted bytes)
+ * allowed per token in queries created afterwards (in exact mode).
+ * Should be called at startup before other threads are started.
+ */
+void match_set_typos(guint typos)
+{
+    match_typos = typos;
+}
+
+/**
+ * Returns number of edits allowed in token of length \a len.
+ * Less than half of the token can be edited so short tokens don't match
+ * everything; tokens longer than #MATCH_MAX_TYPO_TOKEN must match exactly.
+ */
+guint token_typos(gsize len)
+{
+    if ( !len || len > MATCH_MAX_TYPO_TOKEN )
+        return 0;
+
+    return MIN( match_typos, (len - 1) / 2 );
+}
+
+/**
+ * Computes bit mask of positions of each byte in \a token
+ * (both cases of letters).
+ */
+guint64 *token_peq(const gchar *token, gsize len)
+{
+    guint64 *peq = g_new0(guint64, 256);
+    gsize i;
+
+    for ( i = 0; i < len; ++i ) {
+        peq[(guchar)token[i]] |= (guint64)1 << i;
+        peq[(guchar)g_ascii_toupper(token[i])] |= (guint64)1 << i;
+    }
+
+    return peq;
+}
+
+/**
+ * Creates query from filter text.
+ * Tokens in \a needle are separated by spaces (consecutive spaces delimit
+ * empty tokens).
+ */
+Query *query_new(const gchar *needle)
+{
+    Query *query = g_new(Query, 1);
+    QueryToken token;
+    gchar **texts, **text;
+
+    query->needle = g_strdup(needle);
+    query->mode = match_mode;
+    query->typos = match_mode == MATCH_EXACT ? match_typos : 0;
+    query->tokens = g_array_new( FALSE, FALSE, sizeof(QueryToken) );
+
+    if (*needle) {
+        texts = g_strsplit(needle, " ", -1);
+        for ( text = texts; *text; ++text ) {
+            token.text = g_ascii_strdown(*text, -1);
+            token.len = strlen(token.text);
+            token.fail = token_failure_function(token.text, token.len);
+            token.typos = query->typos ? token_typos(token.len) : 0;
+            token.peq = token.typos
+                ? token_peq(token.text, token.len) : NULL;
+            g_array_append_val(query->tokens, token);
+        }
+        g_strfreev(texts);
+    }
+
+    return query;
+}
+
+/** Frees \a query. */
+void query_free(Query *query)
+{
+    QueryToken *token;
+    guint i;
+
+    if (!query)
+        return;
+
+    for ( i = 0; i < query->tokens->len; ++i ) {
+        token = &g_array_index(query->tokens, QueryToken, i);
+        g_free(token->text);
+        g_free(token->fail);
+        g_free(token->peq);
+    }
+    g_array_free(query->tokens, TRUE);
+    g_free(query->needle);
+    g_free(query);
+}
+
+/**
+ * Finds token in text using KMP algorithm (case insensitive).
+ * \returns pointer to first occurrence of \a token in \a len bytes of
+ * \a text, NULL if not found
+ */
+const gchar *find_token_kmp( const QueryToken *token,
+                             const gchar *text,
+                             gsize len )
+{
+    const gchar *s, *end = text + len;
+    gsize k = 0;
+
+    for ( s = text; s < end; ++s ) {
+        while ( k > 0 && g_ascii_tolower(*s) != token->text[k] )
+            k = token->fail[k - 1];
+        if ( g_ascii_tolower(*s) == token->text[k] && ++k == token->len )
+            return s - k + 1;
+    }
+
+    return NULL;
+}
+
+/**
+ * Finds token in text (case insensitive).
+ * \returns pointer to first occurrence of \a token in \a len bytes of
+ * \a text, NULL if not found
+ */
+const gchar *find_token(const QueryToken *token, const gchar *text, gsize len)
+{
+    const gchar *s, *stop;
+
+    if (!token->len)
+        return text;
+
+    /* full comparisons cost at most about len + 16 * token->len */
+    s = find_caseless( token->text, token->len, text, len,
+                       len / token->len + 16, &stop );
+    if ( s || stop == text + len )
+        return s;
+
+    return find_token_kmp(token, stop, text + len - stop);
+}
+
+/**
+ * Finds token with at most QueryToken::typos edits in text
+ * (case insensitive).
+ * \returns pointer after end of the first occurrence of \a token in
+ * \a len bytes of \a text, NULL if not found
+ */
+const gchar *find_token_approx( const QueryToken *token,
+                                const gchar *text,
+                                gsize len )
+{
+    const guint64 last = (guint64)1 << (token->len - 1);
+    guint64 pv = ~(guint64)0, mv = 0, eq, xv, xh, ph, mh;
+    guint score = token->len;
+    gsize i;
+
+    for ( i = 0; i < len; ++i ) {
+        eq = token->peq[(guchar)text[i]];
+        xv = eq | mv;
+        xh = (((eq & pv) + pv) ^ pv) | eq;
+        ph = mv | ~(xh | pv);
+        mh = pv & xh;
+        if (ph & last)
+            ++score;
+        else if (mh & last)
+            --score;
+        /* match can start anywhere in text (first row stays zero) */
+        ph <<= 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+        if (score <= token->typos)
+            return text + i + 1;
+    }
+
+    return NULL;
+}
+
+/**
+ * Match tokens.
+ * Find all tokens of \a query in given order in \a haystack of length
+ * \a len. Search is case insensitive.
+ * \return pointer to first matched substring in \a haystack, NULL if not found
+ */
+const gchar *match_query( const Query *query,
+                          const gchar *haystack,
+                          gsize len )
+{
+    const gchar *pos = haystack, *end = haystack + len, *first = haystack;
+    const gchar *next;
+    const QueryToken *token;
+    guint i;
+
+    if (query->mode == MATCH_FUZZY) {
+        for ( i = 0; i < query->tokens->len; ++i ) {
+            token = &g_array_index(query->tokens, QueryToken, i);
+            /* visibility doesn't need score (see #match_query_score) */
+            pos = fuzzy_find(token->text, token->len, haystack, len);
+            if (!pos)
+                return NULL;
+            first = i == 0 ? pos : MIN(first, pos);
+        }
+        return first;
+    }
+
+    for ( i = 0; i < query->tokens->len; ++i ) {
+        /* token separator has to be matched inside item */
+        if ( i > 0 && pos >= end )
+            return NULL;
+
+        token = &g_array_index(query->tokens, QueryToken, i);
+        if (token->typos) {
+            next = find_token_approx(token, pos, end - pos);
+            if (!next)
+                return NULL;
+            /* approximate start of match */
+            pos = next - MIN( (gsize)(next - pos), token->len );
+        } else {
+            pos = find_token(token, pos, end - pos);
+            if (!pos)
+                return NULL;
+            next = pos + token->len;
+        }
+        if (i == 0)
+            first = pos;
+        pos = next;
+    }
+
+    return first;
+}
+
+/**
+ * Scores match of \a query in \a haystack of length \a len.
+ * \returns score (sum of token scores in fuzzy mode, 0 otherwise),
+ * -1 if not matched
+ */
+gint match_query_score( const Query *query,
+                        const gchar *haystack,
+                        gsize len )
+{
+    const QueryToken *token;
+    gint score = 0, token_score;
+    guint i;
+
+    if (query->mode != MATCH_FUZZY)
+        return match_query(query, haystack, len) ? 0 : -1;
+
+    for ( i = 0; i < query->tokens->len; ++i ) {
+        token = &g_array_index(query->tokens, QueryToken, i);
+        token_score = fuzzy_match(token->text, token->len, haystack, len, NULL);
+        if (token_score < 0)
+            return -1;
+        score += token_score;
+    }
+
+    return score;
+}
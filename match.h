@@ -0,0 +1,62 @@
+/**
+ * \file match.h
+ *
+ * Matching items with text typed by user.
+ */
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <glib.h>
+
+/** ways of matching tokens with items (see #match_set_mode) */
+typedef enum {
+    /** tokens are substrings of item */
+    MATCH_EXACT,
+    /** bytes of each token are found in item in the same order (scored) */
+    MATCH_FUZZY
+} MatchMode;
+
+/** token of query (see #Query) */
+typedef struct {
+    /** token text in lower case (zero-terminated) */
+    gchar *text;
+    /** length of QueryToken::text */
+    gsize len;
+    /** KMP failure function (length of longest proper border of prefix) */
+    gsize *fail;
+    /** number of edits allowed in matched text (see #match_set_typos) */
+    guint typos;
+    /** bit mask of token positions for each byte (NULL if no typos) */
+    guint64 *peq;
+} QueryToken;
+
+/**
+ * Compiled filter text.
+ * Tokens are space separated strings in filter text which must be found
+ * in item in given order (or anywhere in item in fuzzy mode).
+ */
+typedef struct {
+    /** filter text used to create the query */
+    gchar *needle;
+    /** matching mode (see #match_set_mode) */
+    MatchMode mode;
+    /** maximum number of edits per token (see #match_set_typos) */
+    guint typos;
+    /** tokens (#QueryToken) */
+    GArray *tokens;
+} Query;
+
+void match_set_mode(MatchMode mode);
+void match_set_typos(guint typos);
+
+Query *query_new(const gchar *needle);
+void query_free(Query *query);
+
+const gchar *match_query( const Query *query,
+                          const gchar *haystack,
+                          gsize len );
+gint match_query_score( const Query *query,
+                        const gchar *haystack,
+                        gsize len );
+
+#endif /* MATCH_H */
@@ -0,0 +1,279 @@
+/**
+ * \file parallel_sort.c
+ *
+ * Parallel merge sort of item indexes.
+ *
+ * #parallel_sort splits items into one run per thread, sorts the runs in
+ * thread pool and then merges pairs of adjacent runs in rounds until single
+ * run is left. Each run is sorted with the same merge: blocks of
+ * #SORT_BLOCK items are sorted by insertion and merged in rounds. Each merge of two runs is split into one part per thread:
+ * boundaries of output parts are found by binary search over both runs
+ * (the number of items taken from each run for given output position), so
+ * all threads work in the last rounds too and no thread merges more than
+ * about n / threads items in a round.
+ *
+ * Sort is stable (items from the left run go first if equal) so ties keep
+ * the original order of items.
+ *
+ * Compare function is called from worker threads.
+ */
+#include "parallel_sort.h"
+
+#include <string.h>
+
+/** number of items sorted by insertion before merging */
+#define SORT_BLOCK 16
+
+/** part of sort round processed by single task */
+typedef struct {
+    /** Sort items [SortTask::from, SortTask::to) instead of merging. */
+    gboolean sort;
+    /** first item to sort */
+    guint from;
+    /** end of items to sort */
+    guint to;
+    /** first output position of merged items */
+    guint out;
+    /** items [left, left_end) of left run are merged */
+    guint left, left_end;
+    /** with items [right, right_end) of right run */
+    guint right, right_end;
+} SortTask;
+
+/** state shared by tasks */
+typedef struct {
+    /** items to sort (input of current round) */
+    guint *items;
+    /** output of current merge round */
+    guint *buffer;
+    /** function comparing items */
+    ItemCompareFunc compare;
+    /** data for SortContext::compare */
+    gpointer user_data;
+
+    /** lock for SortContext::pending */
+    GMutex lock;
+    /** signaled if all tasks in round finished */
+    GCond done;
+    /** number of unfinished tasks in round */
+    guint pending;
+} SortContext;
+
+/**
+ * Finds how many items of sorted \a left (\a left_len items) are in the
+ * first \a k items of stable merge with sorted \a right (\a right_len items).
+ */
+guint parallel_sort_split( const SortContext *context,
+                           const guint *left,
+                           guint left_len,
+                           const guint *right,
+                           guint right_len,
+                           guint k )
+{
+    guint from = k > right_len ? k - right_len : 0;
+    guint to = MIN(k, left_len), mid;
+
+    while (from < to) {
+        mid = from + (to - from) / 2;
+        /* left item goes before right item with the same key */
+        if ( context->compare(left[mid], right[k - mid - 1],
+                              context->user_data) <= 0 )
+            from = mid + 1;
+        else
+            to = mid;
+    }
+
+    return from;
+}
+
+/**
+ * Merges \a items [i, left_end) with \a items [j, right_end) to \a out
+ * (items from the left go first if equal).
+ */
+void parallel_sort_merge_items( const SortContext *context,
+                                const guint *items,
+                                guint *out,
+                                guint i,
+                                guint left_end,
+                                guint j,
+                                guint right_end )
+{
+    while ( i < left_end && j < right_end ) {
+        if ( context->compare(items[j], items[i], context->user_data) < 0 )
+            *out++ = items[j++];
+        else
+            *out++ = items[i++];
+    }
+
+    memcpy( out, items + i, (left_end - i) * sizeof(guint) );
+    out += left_end - i;
+    memcpy( out, items + j, (right_end - j) * sizeof(guint) );
+}
+
+/** Merges part of two adjacent runs given by \a task. */
+void parallel_sort_merge(const SortTask *task, const SortContext *context)
+{
+    parallel_sort_merge_items( context, context->items,
+                               context->buffer + task->out,
+                               task->left, task->left_end,
+                               task->right, task->right_end );
+}
+
+/**
+ * Sorts items [from, to) in single thread (stable): blocks of
+ * #SORT_BLOCK items are sorted by insertion and then merged in rounds using
+ * the same part of SortContext::buffer.
+ */
+void parallel_sort_range(const SortContext *context, guint from, guint to)
+{
+    guint *items = context->items, *buffer = context->buffer, *swap;
+    guint i, j, k, item, width, mid, end;
+
+    for ( i = from; i < to; i += SORT_BLOCK ) {
+        end = MIN(i + SORT_BLOCK, to);
+        for ( j = i + 1; j < end; ++j ) {
+            item = items[j];
+            for ( k = j; k > i && context->compare(
+                      item, items[k - 1], context->user_data) < 0; --k )
+                items[k] = items[k - 1];
+            items[k] = item;
+        }
+    }
+
+    for ( width = SORT_BLOCK; width < to - from; width *= 2 ) {
+        for ( i = from; i < to; i += 2 * width ) {
+            mid = MIN(i + width, to);
+            end = MIN(i + 2 * width, to);
+            parallel_sort_merge_items( context, items, buffer + i,
+                                       i, mid, mid, end );
+        }
+        swap = items;
+        items = buffer;
+        buffer = swap;
+    }
+
+    if (items != context->items) {
+        memcpy( context->items + from, items + from,
+                (to - from) * sizeof(guint) );
+    }
+}
+
+/** Sorts or merges items in worker thread. */
+void parallel_sort_task(SortTask *task, SortContext *context)
+{
+    if (task->sort) {
+        parallel_sort_range(context, task->from, task->to);
+    } else {
+        parallel_sort_merge(task, context);
+    }
+
+    g_mutex_lock(&context->lock);
+    if (--context->pending == 0)
+        g_cond_signal(&context->done);
+    g_mutex_unlock(&context->lock);
+}
+
+/** Runs \a count tasks in \a pool and waits for them to finish. */
+void parallel_sort_run( GThreadPool *pool,
+                        SortContext *context,
+                        SortTask *tasks,
+                        guint count )
+{
+    guint i;
+
+    context->pending = count;
+    for ( i = 0; i < count; ++i )
+        g_thread_pool_push(pool, &tasks[i], NULL);
+
+    g_mutex_lock(&context->lock);
+    while (context->pending > 0)
+        g_cond_wait(&context->done, &context->lock);
+    g_mutex_unlock(&context->lock);
+}
+
+/**
+ * Sorts \a len store indexes in \a items with \a compare in thread pool
+ * with \a threads workers (number of processors if 0).
+ * Returns after items are sorted.
+ */
+void parallel_sort( guint *items,
+                    guint len,
+                    ItemCompareFunc compare,
+                    gpointer user_data,
+                    guint threads )
+{
+    SortContext context;
+    SortTask *tasks, *task;
+    GThreadPool *pool;
+    guint runs, width, parts, run, part, count, k, from, mid, to, *swap;
+
+    if (!threads)
+        threads = g_get_num_processors();
+    runs = MIN( threads, MAX(len / 2, 1) );
+
+    context.items = items;
+    context.buffer = g_new(guint, MAX(len, 1));
+    context.compare = compare;
+    context.user_data = user_data;
+    g_mutex_init(&context.lock);
+    g_cond_init(&context.done);
+
+    tasks = g_new0(SortTask, threads);
+    pool = g_thread_pool_new( (GFunc)parallel_sort_task, &context,
+                              threads, TRUE, NULL );
+
+    /* sort runs of the same length */
+    for ( run = 0; run < runs; ++run ) {
+        task = &tasks[run];
+        task->sort = TRUE;
+        task->from = (guint64)len * run / runs;
+        task->to = (guint64)len * (run + 1) / runs;
+    }
+    parallel_sort_run(pool, &context, tasks, runs);
+
+    /*
+     * merge pairs of runs (last run is only copied if it has no pair);
+     * each merge is split to parts of the same size
+     */
+    for ( width = 1; width < runs; width *= 2 ) {
+        parts = MAX( threads / ((runs + 2 * width - 1) / (2 * width)), 1 );
+        count = 0;
+        for ( run = 0; run < runs; run += 2 * width ) {
+            from = (guint64)len * run / runs;
+            mid = (guint64)len * MIN(run + width, runs) / runs;
+            to = (guint64)len * MIN(run + 2 * width, runs) / runs;
+            for ( part = 0; part < parts; ++part ) {
+                task = &tasks[count++];
+                task->sort = FALSE;
+                task->out = from + (guint64)(to - from) * part / parts;
+                k = task->out - from;
+                task->left = from + parallel_sort_split( &context,
+                        context.items + from, mid - from,
+                        context.items + mid, to - mid, k );
+                task->right = mid + k - (task->left - from);
+                k = (guint64)(to - from) * (part + 1) / parts;
+                task->left_end = from + parallel_sort_split( &context,
+                        context.items + from, mid - from,
+                        context.items + mid, to - mid, k );
+                task->right_end = mid + k - (task->left_end - from);
+            }
+        }
+        parallel_sort_run(pool, &context, tasks, count);
+
+        swap = context.items;
+        context.items = context.buffer;
+        context.buffer = swap;
+    }
+
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    if (context.items != items) {
+        memcpy( items, context.items, len * sizeof(guint) );
+        context.buffer = context.items;
+    }
+
+    g_free(context.buffer);
+    g_free(tasks);
+    g_mutex_clear(&context.lock);
+    g_cond_clear(&context.done);
+}
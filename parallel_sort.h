@@ -0,0 +1,17 @@
+/**
+ * \file parallel_sort.h
+ *
+ * Parallel merge sort of item indexes.
+ */
+#ifndef PARALLEL_SORT_H
+#define PARALLEL_SORT_H
+
+#include "item_view.h"
+
+void parallel_sort( guint *items,
+                    guint len,
+                    ItemCompareFunc compare,
+                    gpointer user_data,
+                    guint threads );
+
+#endif /* PARALLEL_SORT_H */
@@ -0,0 +1,494 @@
+/**
+ * \file reader.c
+ *
+ * Reading and parsing items in background thread.
+ *
+ * Thread started with #reader_new reads input in blocks of at most
+ * #READ_BLOCK_SIZE bytes. Items can be longer than a block; unterminated item
+ * at end of a block is kept until its separator is read. Item texts are
+ * copied to arena as raw bytes. All complete items in a block are put in single
+ * #ItemBatch which is pushed to queue (lock-free ring buffer with single
+ * producer and single consumer). If the queue is full, reader thread waits
+ * until main event loop frees some space.
+ *
+ * If input is a regular file, it is mapped to memory instead of being read
+ * in blocks and items are kept as slices of the mapped file
+ * (ItemRecord::text points to the mapping). Only the part of the file after
+ * current file position is parsed (input could be partially read already).
+ *
+ * If sort key function is passed to #reader_new, key of each item is
+ * computed in reader thread and copied to arena (ItemRecord::key).
+ *
+ * Main event loop is woken up only if the queue was empty (callback passed
+ * to #reader_new is added as idle function) and it should call #reader_pop
+ * until it returns NULL.
+ */
+#include "reader.h"
+#include "match.h"
+#include "scan.h"
+
+#include <gio/gio.h>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+ * Maximum number of bytes read from input at once.
+ * All items in the block are passed to main event loop in single batch.
+ */
+#define READ_BLOCK_SIZE 65536
+
+/** number of bytes at beginning of input used to estimate number of items */
+#define SIZE_HINT_SAMPLE 65536
+
+/** maximum estimated number of items (store grows if there are more) */
+#define SIZE_HINT_MAX (1 << 24)
+
+/** maximum number of batches in queue (must be power of two) */
+#define QUEUE_SIZE 64
+
+struct _Reader {
+    /** input file descriptor */
+    int fd;
+    /** input separator (unescaped) */
+    gchar *sep;
+    /** input separator length */
+    gsize sep_len;
+
+    /** mapped input file or NULL */
+    GMappedFile *map;
+    /** offset of input in mapped file (file position when reader started) */
+    gsize map_offset;
+    /** estimated number of items */
+    guint size_hint;
+
+    /**\{ \name Queue */
+    /** ring buffer */
+    ItemBatch *queue[QUEUE_SIZE];
+    /** index of next batch to pop (written only by main thread) */
+    gint head;
+    /** index of next batch to push (written only by reader thread) */
+    gint tail;
+    /**\}*/
+
+    /** Callback is scheduled in main event loop. */
+    gint scheduled;
+    /** callback to process batches */
+    GSourceFunc func;
+    /** data for callback */
+    gpointer data;
+
+    /** lock for #filter_text and for waiting on free space in queue */
+    GMutex lock;
+    /** signaled if batch was popped from queue */
+    GCond cond;
+    /** filter text for new items */
+    gchar *filter_text;
+    /** compiled filter text of last batch (used only by reader thread) */
+    Query *query;
+
+    /** memory for item texts */
+    Arena *arena;
+    /** function computing sort keys or NULL */
+    SortKeyFunc key_func;
+    /** buffer for sort key */
+    GString *key;
+    /** number of bytes allocated for sort keys */
+    gsize key_size;
+    /** file path for querying content type */
+    GString *path;
+
+    /** number of bytes read */
+    guint64 bytes_read;
+    /** number of calls to read() */
+    guint reads;
+};
+
+/**
+ * File content type.
+ * \return interned content type if file with path \a filename (of length
+ * \a len) exists, NULL otherwise
+ */
+const gchar *content_type_from_file( const gchar *filename,
+                                     gsize len,
+                                     Reader *reader )
+{
+    const gchar *content_type = NULL;
+    GFile *file;
+
+    g_string_truncate(reader->path, 0);
+    g_string_append_len(reader->path, filename, len);
+    file = g_file_new_for_path(reader->path->str);
+
+    if (file) {
+        GFileInfo *info =
+            g_file_query_info( file, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
+                               G_FILE_QUERY_INFO_NONE, NULL, NULL );
+        if (info) {
+            content_type =
+                g_intern_string( g_file_info_get_content_type(info) );
+            g_object_unref(info);
+        }
+        g_object_unref(file);
+    }
+
+    return content_type;
+}
+
+/** Creates empty batch. */
+ItemBatch *item_batch_new(Reader *reader)
+{
+    ItemBatch *batch = g_slice_new(ItemBatch);
+
+    batch->records = g_array_new( FALSE, FALSE, sizeof(ItemRecord) );
+    batch->last = FALSE;
+
+    g_mutex_lock(&reader->lock);
+    batch->filter_text = g_strdup(reader->filter_text);
+    g_mutex_unlock(&reader->lock);
+
+    if ( strcmp(reader->query->needle, batch->filter_text) != 0 ) {
+        query_free(reader->query);
+        reader->query = query_new(batch->filter_text);
+    }
+
+    return batch;
+}
+
+/** Frees \a batch. */
+void item_batch_free(ItemBatch *batch)
+{
+    g_array_free(batch->records, TRUE);
+    g_free(batch->filter_text);
+    g_slice_free(ItemBatch, batch);
+}
+
+/**
+ * Adds item with \a text of length \a len to \a batch.
+ * Item text is copied to arena unless input is mapped.
+ * Empty items are skipped.
+ */
+void item_batch_add( ItemBatch *batch,
+                     const gchar *text,
+                     gsize len,
+                     Reader *reader )
+{
+    ItemRecord record;
+    gchar *item;
+
+    if (!len)
+        return;
+
+    record.len = len;
+    if (reader->map) {
+        record.text = text;
+    } else {
+        item = arena_alloc(reader->arena, len);
+        memcpy(item, text, len);
+        record.text = item;
+    }
+
+    record.key = NULL;
+    if (reader->key_func) {
+        g_string_truncate(reader->key, 0);
+        reader->key_func(reader->key, record.text, record.len);
+        reader->key_size += reader->key->len + 1;
+        item = arena_alloc(reader->arena, reader->key->len + 1);
+        memcpy(item, reader->key->str, reader->key->len + 1);
+        record.key = item;
+    }
+
+    record.content_type = content_type_from_file(record.text, record.len, reader);
+    record.visible =
+        match_query(reader->query, record.text, record.len) != NULL;
+    g_array_append_val(batch->records, record);
+}
+
+/**
+ * Pushes \a batch to queue.
+ * Waits if queue is full.
+ */
+void reader_push(Reader *reader, ItemBatch *batch)
+{
+    gint tail = reader->tail;
+
+    if ( tail - g_atomic_int_get(&reader->head) == QUEUE_SIZE ) {
+        g_mutex_lock(&reader->lock);
+        while ( tail - g_atomic_int_get(&reader->head) == QUEUE_SIZE )
+            g_cond_wait(&reader->cond, &reader->lock);
+        g_mutex_unlock(&reader->lock);
+    }
+
+    reader->queue[tail & (QUEUE_SIZE-1)] = batch;
+    g_atomic_int_set(&reader->tail, tail + 1);
+
+    /* wake up main event loop */
+    if ( g_atomic_int_compare_and_exchange(&reader->scheduled, FALSE, TRUE) )
+        g_idle_add(reader->func, reader->data);
+}
+
+/**
+ * Pops batch from queue.
+ * Called from main event loop.
+ * \returns next batch or NULL if queue is empty (callback passed to
+ * #reader_new will be called again if new batch arrives)
+ */
+ItemBatch *reader_pop(Reader *reader)
+{
+    ItemBatch *batch;
+    gint head = reader->head;
+
+    if ( head == g_atomic_int_get(&reader->tail) ) {
+        g_atomic_int_set(&reader->scheduled, FALSE);
+        /* batch could be pushed before callback was unscheduled */
+        if ( head == g_atomic_int_get(&reader->tail) ||
+             !g_atomic_int_compare_and_exchange(&reader->scheduled,
+                                                FALSE, TRUE) )
+            return NULL;
+    }
+
+    batch = reader->queue[head & (QUEUE_SIZE-1)];
+    g_atomic_int_set(&reader->head, head + 1);
+
+    /* wake up reader thread if it waits on free space */
+    g_mutex_lock(&reader->lock);
+    g_cond_signal(&reader->cond);
+    g_mutex_unlock(&reader->lock);
+
+    return batch;
+}
+
+/**
+ * Reader thread.
+ * Reads items from input until end of input or error.
+ */
+gpointer reader_thread(Reader *reader)
+{
+    GByteArray *input = g_byte_array_sized_new(READ_BLOCK_SIZE);
+    /* position in input from which to continue searching for separator */
+    gsize scan_from = 0;
+    const gchar *sep = reader->sep;
+    gsize sep_len = reader->sep_len;
+    const gchar *data, *a;
+    gsize len, start;
+    ssize_t n;
+    ItemBatch *batch;
+
+    do {
+        len = input->len;
+        g_byte_array_set_size(input, len + READ_BLOCK_SIZE);
+        do {
+            n = read(reader->fd, input->data + len, READ_BLOCK_SIZE);
+        } while (n < 0 && errno == EINTR);
+        g_byte_array_set_size(input, len + (n > 0 ? n : 0));
+
+        ++reader->reads;
+        if (n > 0)
+            reader->bytes_read += n;
+
+        batch = item_batch_new(reader);
+
+        /* split items */
+        data = (const gchar *)input->data;
+        len = input->len;
+        start = 0;
+        while ( (a = find_separator(sep, sep_len,
+                                    data + scan_from, len - scan_from)) ) {
+            item_batch_add(batch, data + start, a - data - start, reader);
+            start = scan_from = a - data + sep_len;
+        }
+
+        /* separator can be split between blocks */
+        scan_from = len - start >= sep_len ? len - sep_len + 1 : start;
+
+        g_byte_array_remove_range(input, 0, start);
+        scan_from -= start;
+
+        if (n <= 0) {
+            /* last item */
+            item_batch_add( batch, (const gchar *)input->data, input->len,
+                            reader );
+            batch->last = TRUE;
+        }
+
+        if ( batch->records->len || batch->last )
+            reader_push(reader, batch);
+        else
+            item_batch_free(batch);
+    } while (n > 0);
+
+    g_byte_array_free(input, TRUE);
+
+    return NULL;
+}
+
+/**
+ * Reader thread for mapped input.
+ * Items from each #READ_BLOCK_SIZE bytes of input are passed to main event
+ * loop in single batch.
+ */
+gpointer reader_map_thread(Reader *reader)
+{
+    const gchar *sep = reader->sep;
+    gsize sep_len = reader->sep_len;
+    const gchar *start = g_mapped_file_get_contents(reader->map) +
+        reader->map_offset;
+    const gchar *end = g_mapped_file_get_contents(reader->map) +
+        g_mapped_file_get_length(reader->map);
+    const gchar *block_end, *a;
+    ItemBatch *batch;
+
+    reader->bytes_read = end - start;
+
+    do {
+        batch = item_batch_new(reader);
+
+        block_end = start + MIN(READ_BLOCK_SIZE, end - start);
+        while (start < block_end) {
+            a = find_separator(sep, sep_len, start, end - start);
+            if (!a) {
+                item_batch_add(batch, start, end - start, reader);
+                start = end;
+            } else {
+                item_batch_add(batch, start, a - start, reader);
+                start = a + sep_len;
+            }
+        }
+
+        batch->last = start == end;
+        reader_push(reader, batch);
+    } while (!batch->last);
+
+    return NULL;
+}
+
+/**
+ * Estimates number of items in mapped input.
+ * Counts non-empty items in first #SIZE_HINT_SAMPLE bytes.
+ * The estimate is at most the number of non-empty items which fit in input
+ * and at most #SIZE_HINT_MAX.
+ */
+guint estimate_size(Reader *reader)
+{
+    const gchar *data = g_mapped_file_get_contents(reader->map) +
+        reader->map_offset;
+    gsize len = g_mapped_file_get_length(reader->map) - reader->map_offset;
+    gsize sample = MIN(len, SIZE_HINT_SAMPLE);
+    const gchar *a, *start = data, *end = data + sample;
+    guint count = 0;
+    gdouble estimate;
+
+    while ( (a = find_separator(reader->sep, reader->sep_len,
+                                start, end - start)) ) {
+        /* empty items are skipped */
+        if (a > start)
+            ++count;
+        start = a + reader->sep_len;
+    }
+
+    estimate = (gdouble)len * (count + 1) / sample;
+    estimate = MIN( estimate, (gdouble)len / (reader->sep_len + 1) + 1 );
+
+    return MIN(estimate, SIZE_HINT_MAX);
+}
+
+/**
+ * Starts reading items from \a fd in new thread.
+ * If \a fd is a regular file, it is mapped to memory.
+ * Items are separated by unescaped \a sep of length \a sep_len.
+ * If \a key_func is not NULL, it is used to compute sort keys of items.
+ * If items are available, \a func is called from main event loop
+ * with \a data.
+ */
+Reader *reader_new( int fd,
+                    const gchar *sep,
+                    gsize sep_len,
+                    SortKeyFunc key_func,
+                    GSourceFunc func,
+                    gpointer data )
+{
+    Reader *reader = g_new0(Reader, 1);
+    struct stat st;
+    off_t offset;
+    GThreadFunc thread_func = (GThreadFunc)reader_thread;
+
+    reader->fd = fd;
+    reader->sep = g_memdup2(sep, sep_len + 1);
+    reader->sep_len = sep_len;
+    reader->func = func;
+    reader->data = data;
+    reader->filter_text = g_strdup("");
+    reader->query = query_new("");
+    reader->arena = arena_new();
+    reader->key_func = key_func;
+    reader->key = g_string_new(NULL);
+    reader->path = g_string_new(NULL);
+    g_mutex_init(&reader->lock);
+    g_cond_init(&reader->cond);
+
+    /* input could be partially read already (e.g. by shell "read") */
+    offset = lseek(fd, 0, SEEK_CUR);
+    if ( fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+         offset >= 0 && st.st_size > offset ) {
+        reader->map_offset = offset;
+        reader->map = g_mapped_file_new_from_fd(fd, FALSE, NULL);
+        if (reader->map) {
+            reader->size_hint = estimate_size(reader);
+            thread_func = (GThreadFunc)reader_map_thread;
+        }
+    }
+
+    g_thread_unref( g_thread_new("reader", thread_func, reader) );
+
+    return reader;
+}
+
+/**
+ * Sets filter text for evaluating visibility of new items.
+ */
+void reader_set_filter(Reader *reader, const gchar *filter_text)
+{
+    g_mutex_lock(&reader->lock);
+    g_free(reader->filter_text);
+    reader->filter_text = g_strdup(filter_text);
+    g_mutex_unlock(&reader->lock);
+}
+
+/** Number of bytes read so far. */
+guint64 reader_get_bytes_read(Reader *reader)
+{
+    return reader->bytes_read;
+}
+
+/** Number of calls to read() so far. */
+guint reader_get_reads(Reader *reader)
+{
+    return reader->reads;
+}
+
+/** Memory used for item texts and sort keys. */
+const Arena *reader_get_arena(Reader *reader)
+{
+    return reader->arena;
+}
+
+/** Memory used for sort keys (part of arena, see #reader_get_arena). */
+gsize reader_get_key_size(Reader *reader)
+{
+    return reader->key_size;
+}
+
+/** Estimated number of items (0 if unknown). */
+guint reader_get_size_hint(Reader *reader)
+{
+    return reader->size_hint;
+}
+
+/** Size of mapped input (0 if input is not mapped). */
+gsize reader_get_mapped_size(Reader *reader)
+{
+    return reader->map
+        ? g_mapped_file_get_length(reader->map) - reader->map_offset : 0;
+}
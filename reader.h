@@ -0,0 +1,67 @@
+/**
+ * \file reader.h
+ *
+ * Reading and parsing items in background thread.
+ *
+ * Reader thread reads input in blocks, splits items, stores item texts and
+ * prepares records for items (file content type and visibility). Records are
+ * grouped in batches (#ItemBatch) which are passed to main event loop through
+ * single-producer/single-consumer queue.
+ *
+ * Item texts are stored in arena (see arena.h) or in mapped input file and
+ * stay valid until end of the program. Sort keys of items (if requested)
+ * are computed by reader thread and stored in the arena too.
+ */
+#ifndef READER_H
+#define READER_H
+
+#include "arena.h"
+#include "sort_key.h"
+
+#include <glib.h>
+
+/** item prepared by reader thread */
+typedef struct {
+    /** item text (raw bytes, not zero-terminated) */
+    const gchar *text;
+    /** length of ItemRecord::text */
+    gsize len;
+    /** sort key (zero-terminated, see sort_key.h) or NULL */
+    const gchar *key;
+    /** content type if item is path to existing file, NULL otherwise */
+    const gchar *content_type;
+    /** item matches ItemBatch::filter_text */
+    gboolean visible;
+} ItemRecord;
+
+/** batch of items passed from reader thread to main event loop */
+typedef struct {
+    /** item records (#ItemRecord) */
+    GArray *records;
+    /** filter text used to evaluate ItemRecord::visible */
+    gchar *filter_text;
+    /** No more items on input. */
+    gboolean last;
+} ItemBatch;
+
+/** reader thread and item queue */
+typedef struct _Reader Reader;
+
+Reader *reader_new( int fd,
+                    const gchar *sep,
+                    gsize sep_len,
+                    SortKeyFunc key_func,
+                    GSourceFunc func,
+                    gpointer data );
+void reader_set_filter(Reader *reader, const gchar *filter_text);
+ItemBatch *reader_pop(Reader *reader);
+void item_batch_free(ItemBatch *batch);
+
+guint64 reader_get_bytes_read(Reader *reader);
+guint reader_get_reads(Reader *reader);
+const Arena *reader_get_arena(Reader *reader);
+gsize reader_get_key_size(Reader *reader);
+guint reader_get_size_hint(Reader *reader);
+gsize reader_get_mapped_size(Reader *reader);
+
+#endif /* READER_H */
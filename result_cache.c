@@ -0,0 +1,176 @@
+/**
+ * \file result_cache.c
+ *
+ * Cache of item visibility for earlier filter texts.
+ *
+ * After items are filtered, visibility of all items is saved as a bitmap
+ * (one bit per item) with the filter text (#result_cache_add). Items
+ * matching a filter text also match any text which starts with it (see
+ * #refilter), so #result_cache_restore can use result of the same text
+ * (e.g. after deleting characters) or of the longest cached text which
+ * the new text extends (e.g. after editing in the middle of text); in the
+ * latter case only restored visible items have to be matched again.
+ *
+ * Bitmaps cover only items which existed when the result was saved;
+ * newer items are restored as visible and have to be matched.
+ */
+#include "result_cache.h"
+
+#include <string.h>
+
+/** cached filter result */
+typedef struct {
+    /** filter text */
+    gchar *filter_text;
+    /** number of items */
+    guint len;
+    /** visibility of items (bit for each item) */
+    guint8 *bits;
+} ResultCacheEntry;
+
+/** Returns size of \a entry in bytes. */
+gsize result_cache_entry_size(const ResultCacheEntry *entry)
+{
+    return sizeof(ResultCacheEntry) + strlen(entry->filter_text) + 1 +
+        (entry->len + 7) / 8;
+}
+
+/** Frees \a entry. */
+void result_cache_entry_free(ResultCacheEntry *entry)
+{
+    g_free(entry->filter_text);
+    g_free(entry->bits);
+    g_slice_free(ResultCacheEntry, entry);
+}
+
+/** Creates empty cache for at most \a max_size bytes of results. */
+ResultCache *result_cache_new(gsize max_size)
+{
+    ResultCache *cache = g_new0(ResultCache, 1);
+
+    cache->entries = g_queue_new();
+    cache->max_size = max_size;
+
+    return cache;
+}
+
+/** Frees \a cache. */
+void result_cache_free(ResultCache *cache)
+{
+    g_queue_free_full( cache->entries, (GDestroyNotify)result_cache_entry_free );
+    g_free(cache);
+}
+
+/** Removes entry at \a link from \a cache. */
+void result_cache_remove(ResultCache *cache, GList *link)
+{
+    ResultCacheEntry *entry = link->data;
+
+    cache->size -= result_cache_entry_size(entry);
+    g_queue_delete_link(cache->entries, link);
+    result_cache_entry_free(entry);
+}
+
+/**
+ * Saves visibility of items in \a store as result for \a filter_text.
+ * Older result for the same text is replaced. Least recently used results
+ * are evicted if the cache is full.
+ */
+void result_cache_add( ResultCache *cache,
+                       const gchar *filter_text,
+                       const ItemStore *store )
+{
+    ResultCacheEntry *entry;
+    GList *link;
+    guint i, len = item_store_get_length(store);
+
+    for ( link = cache->entries->head; link; link = link->next ) {
+        entry = link->data;
+        if ( g_ascii_strcasecmp(entry->filter_text, filter_text) == 0 ) {
+            /* already up to date */
+            if (entry->len == len) {
+                g_queue_unlink(cache->entries, link);
+                g_queue_push_head_link(cache->entries, link);
+                return;
+            }
+            result_cache_remove(cache, link);
+            break;
+        }
+    }
+
+    entry = g_slice_new(ResultCacheEntry);
+    entry->filter_text = g_strdup(filter_text);
+    entry->len = len;
+    entry->bits = g_malloc0( (len + 7) / 8 );
+    for ( i = 0; i < len; ++i ) {
+        if ( item_store_get_visible(store, i) )
+            entry->bits[i / 8] |= 1 << (i % 8);
+    }
+
+    g_queue_push_head(cache->entries, entry);
+    cache->size += result_cache_entry_size(entry);
+
+    while ( cache->size > cache->max_size && cache->entries->length > 0 ) {
+        result_cache_remove(cache, cache->entries->tail);
+        ++cache->evictions;
+    }
+}
+
+/**
+ * Restores visibility of items in \a store for \a filter_text.
+ * Uses result for \a filter_text or, if not available, for the longest
+ * cached text which \a filter_text starts with (case insensitive).
+ * Items which are not in the result are made visible.
+ *
+ * \a exact is set to TRUE if result for \a filter_text was found and \a len
+ * is set to number of items in the result.
+ * \returns TRUE if a result was restored
+ */
+gboolean result_cache_restore( ResultCache *cache,
+                               const gchar *filter_text,
+                               ItemStore *store,
+                               gboolean *exact,
+                               guint *len )
+{
+    ResultCacheEntry *entry, *best = NULL;
+    GList *link, *best_link = NULL;
+    gsize key_len, best_len = 0;
+    guint i, store_len = item_store_get_length(store);
+
+    for ( link = cache->entries->head; link; link = link->next ) {
+        entry = link->data;
+        key_len = strlen(entry->filter_text);
+        if ( (!best || key_len > best_len) &&
+             g_ascii_strncasecmp(entry->filter_text, filter_text,
+                                 key_len) == 0 )
+        {
+            best = entry;
+            best_link = link;
+            best_len = key_len;
+        }
+    }
+
+    if (!best) {
+        ++cache->misses;
+        return FALSE;
+    }
+
+    *exact = filter_text[best_len] == '\0';
+    *len = MIN(best->len, store_len);
+    if (*exact)
+        ++cache->hits;
+    else
+        ++cache->prefix_hits;
+
+    for ( i = 0; i < *len; ++i ) {
+        item_store_set_visible( store, i,
+                                (best->bits[i / 8] >> (i % 8)) & 1 );
+    }
+    for ( ; i < store_len; ++i )
+        item_store_set_visible(store, i, TRUE);
+
+    g_queue_unlink(cache->entries, best_link);
+    g_queue_push_head_link(cache->entries, best_link);
+
+    return TRUE;
+}
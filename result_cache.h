@@ -0,0 +1,49 @@
+/**
+ * \file result_cache.h
+ *
+ * Cache of item visibility for earlier filter texts.
+ */
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "item_store.h"
+
+#include <glib.h>
+
+/**
+ * Cache of filter results.
+ * Entries are kept in least-recently-used order; the oldest are evicted
+ * if total size exceeds ResultCache::max_size.
+ */
+typedef struct {
+    /** cached results (most recently used first) */
+    GQueue *entries;
+    /** size of all entries in bytes */
+    gsize size;
+    /** maximum size of all entries in bytes */
+    gsize max_size;
+
+    /**\{ \name Statistics */
+    /** lookups which found result for the same filter text */
+    guint hits;
+    /** lookups which found result for shorter filter text */
+    guint prefix_hits;
+    /** lookups which found nothing */
+    guint misses;
+    /** evicted entries */
+    guint evictions;
+    /**\}*/
+} ResultCache;
+
+ResultCache *result_cache_new(gsize max_size);
+void result_cache_free(ResultCache *cache);
+void result_cache_add( ResultCache *cache,
+                       const gchar *filter_text,
+                       const ItemStore *store );
+gboolean result_cache_restore( ResultCache *cache,
+                               const gchar *filter_text,
+                               ItemStore *store,
+                               gboolean *exact,
+                               guint *len );
+
+#endif /* RESULT_CACHE_H */
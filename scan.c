@@ -0,0 +1,454 @@
+/**
+ * \file scan.c
+ *
+ * Searching for item separators in input and for filter tokens in items.
+ *
+ * Input is scanned in blocks of 64 (AVX-512), 32 (AVX2) or 16 (SSE2) bytes. For each
+ * position in a block, first byte of the block is compared with first byte
+ * of separator and byte at offset \c sep_len-1 with last byte of separator.
+ * Only positions where both bytes match are compared with whole separator,
+ * so single-byte separators are found like with \c memchr and multi-byte
+ * separators (e.g. \c "\0\n" or \c "---") rarely need a full comparison.
+ *
+ * Filter tokens are searched the same way (#find_caseless) except that
+ * both lower and upper case variant of the first and last byte are
+ * compared. Number of candidates compared with whole token is limited by
+ * caller so that pathological inputs (e.g. token \c "aaab" in item
+ * \c "aaaa...") can be handed over to an algorithm with linear worst case.
+ *
+ * Each kernel is compiled for all instruction sets (using target attribute,
+ * so the program itself can be built for baseline CPU) and the best variant
+ * supported by CPU is selected once at startup by #scan_init. Remaining
+ * bytes (and whole input on other architectures or before #scan_init is
+ * called) are scanned with #find_separator_scalar and #find_caseless_scalar.
+ */
+#include "scan.h"
+
+#include <string.h>
+
+#if ( defined(__x86_64__) || defined(__i386__) ) && defined(__GNUC__)
+#   define SCAN_X86
+#   include <immintrin.h>
+#endif
+
+/**
+ * Checks candidate positions of separator.
+ * Bit \c i in \a mask is set if first and last byte of \a sep match
+ * at \a str + \c i.
+ * \returns pointer to first candidate matching whole \a sep, NULL if none
+ */
+const gchar *check_candidates( guint32 mask,
+                               const gchar *sep,
+                               gsize sep_len,
+                               const gchar *str )
+{
+    const gchar *s;
+
+    while (mask) {
+        s = str + g_bit_nth_lsf(mask, -1);
+        if ( sep_len <= 2 || memcmp(s + 1, sep + 1, sep_len - 2) == 0 )
+            return s;
+        mask &= mask - 1;
+    }
+
+    return NULL;
+}
+
+/**
+ * Finds separator without vector instructions.
+ * \returns pointer to first occurrence of \a sep in \a str, NULL if not found
+ */
+const gchar *find_separator_scalar( const gchar *sep,
+                                    gsize sep_len,
+                                    const gchar *str,
+                                    gsize len )
+{
+    const gchar *s, *end;
+
+    if (sep_len > len)
+        return NULL;
+
+    /* last position where separator can start */
+    end = str + len - sep_len + 1;
+    for ( s = str; s < end && (s = memchr(s, sep[0], end - s)); ++s ) {
+        if ( memcmp(s + 1, sep + 1, sep_len - 1) == 0 )
+            return s;
+    }
+
+    return NULL;
+}
+
+#ifdef SCAN_X86
+/** Finds separator in blocks of 16 bytes. */
+__attribute__((target("sse2")))
+const gchar *find_separator_sse2( const gchar *sep,
+                                  gsize sep_len,
+                                  const gchar *str,
+                                  gsize len )
+{
+    const __m128i first = _mm_set1_epi8(sep[0]);
+    const __m128i last = _mm_set1_epi8(sep[sep_len - 1]);
+    const gchar *s = str, *end = str + len - sep_len + 1, *result;
+    __m128i a, b;
+    guint32 mask;
+
+    for ( ; end - s >= 16; s += 16 ) {
+        a = _mm_loadu_si128( (const __m128i *)s );
+        b = _mm_loadu_si128( (const __m128i *)(s + sep_len - 1) );
+        mask = _mm_movemask_epi8(
+                _mm_and_si128( _mm_cmpeq_epi8(a, first),
+                               _mm_cmpeq_epi8(b, last) ) );
+        if ( mask && (result = check_candidates(mask, sep, sep_len, s)) )
+            return result;
+    }
+
+    return find_separator_scalar(sep, sep_len, s, str + len - s);
+}
+
+/** Finds separator in blocks of 32 bytes. */
+__attribute__((target("avx2")))
+const gchar *find_separator_avx2( const gchar *sep,
+                                  gsize sep_len,
+                                  const gchar *str,
+                                  gsize len )
+{
+    const __m256i first = _mm256_set1_epi8(sep[0]);
+    const __m256i last = _mm256_set1_epi8(sep[sep_len - 1]);
+    const gchar *s = str, *end = str + len - sep_len + 1, *result;
+    __m256i a, b;
+    guint32 mask;
+
+    for ( ; end - s >= 32; s += 32 ) {
+        a = _mm256_loadu_si256( (const __m256i *)s );
+        b = _mm256_loadu_si256( (const __m256i *)(s + sep_len - 1) );
+        mask = _mm256_movemask_epi8(
+                _mm256_and_si256( _mm256_cmpeq_epi8(a, first),
+                                  _mm256_cmpeq_epi8(b, last) ) );
+        if ( mask && (result = check_candidates(mask, sep, sep_len, s)) )
+            return result;
+    }
+
+    return find_separator_scalar(sep, sep_len, s, str + len - s);
+}
+
+/** Finds separator in blocks of 64 bytes. */
+__attribute__((target("avx512bw")))
+const gchar *find_separator_avx512( const gchar *sep,
+                                    gsize sep_len,
+                                    const gchar *str,
+                                    gsize len )
+{
+    const __m512i first = _mm512_set1_epi8(sep[0]);
+    const __m512i last = _mm512_set1_epi8(sep[sep_len - 1]);
+    const gchar *s = str, *end = str + len - sep_len + 1, *result;
+    __m512i a, b;
+    guint64 mask;
+
+    for ( ; end - s >= 64; s += 64 ) {
+        a = _mm512_loadu_si512( (const void *)s );
+        b = _mm512_loadu_si512( (const void *)(s + sep_len - 1) );
+        mask = _mm512_cmpeq_epi8_mask(a, first)
+             & _mm512_cmpeq_epi8_mask(b, last);
+        if ( (guint32)mask &&
+             (result = check_candidates((guint32)mask, sep, sep_len, s)) )
+            return result;
+        if ( (mask >> 32) &&
+             (result = check_candidates(mask >> 32, sep, sep_len, s + 32)) )
+            return result;
+    }
+
+    return find_separator_scalar(sep, sep_len, s, str + len - s);
+}
+#endif
+
+/**
+ * Compares \a len bytes of \a str with lower case \a needle
+ * (case insensitive).
+ */
+gboolean caseless_equal(const gchar *needle, const gchar *str, gsize len)
+{
+    gsize i;
+
+    for ( i = 0; i < len; ++i ) {
+        if ( needle[i] != g_ascii_tolower(str[i]) )
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * Checks candidate positions of token.
+ * Bit \c i in \a mask is set if first and last byte of \a needle match
+ * at \a str + \c i (case insensitive).
+ * Decrements \a checks for each candidate compared with whole token;
+ * if it reaches zero, sets \a stop to next position to search.
+ * \returns pointer to first candidate matching whole \a needle, NULL if none
+ */
+const gchar *check_caseless_candidates( guint32 mask,
+                                        const gchar *needle,
+                                        gsize needle_len,
+                                        const gchar *str,
+                                        gsize *checks,
+                                        const gchar **stop )
+{
+    const gchar *s;
+
+    while (mask) {
+        s = str + g_bit_nth_lsf(mask, -1);
+        if ( needle_len <= 2 ||
+             caseless_equal(needle + 1, s + 1, needle_len - 2) )
+            return s;
+        if ( --*checks == 0 ) {
+            *stop = s + 1;
+            return NULL;
+        }
+        mask &= mask - 1;
+    }
+
+    return NULL;
+}
+
+/**
+ * Finds token without vector instructions.
+ * \see find_caseless
+ */
+const gchar *find_caseless_scalar( const gchar *needle,
+                                   gsize needle_len,
+                                   const gchar *str,
+                                   gsize len,
+                                   gsize checks,
+                                   const gchar **stop )
+{
+    const gchar *s, *end;
+    gchar first = needle[0];
+    gchar first_upper = g_ascii_toupper(first);
+
+    *stop = str + len;
+    if (needle_len > len)
+        return NULL;
+
+    /* last position where token can start */
+    end = str + len - needle_len + 1;
+    for ( s = str; s < end; ++s ) {
+        if ( *s != first && *s != first_upper )
+            continue;
+        if ( caseless_equal(needle + 1, s + 1, needle_len - 1) )
+            return s;
+        if ( --checks == 0 ) {
+            *stop = s + 1;
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+#ifdef SCAN_X86
+/** Finds token in blocks of 16 bytes. */
+__attribute__((target("sse2")))
+const gchar *find_caseless_sse2( const gchar *needle,
+                                 gsize needle_len,
+                                 const gchar *str,
+                                 gsize len,
+                                 gsize checks,
+                                 const gchar **stop )
+{
+    const gchar last = needle[needle_len - 1];
+    const __m128i first1 = _mm_set1_epi8(needle[0]);
+    const __m128i first2 = _mm_set1_epi8( g_ascii_toupper(needle[0]) );
+    const __m128i last1 = _mm_set1_epi8(last);
+    const __m128i last2 = _mm_set1_epi8( g_ascii_toupper(last) );
+    const gchar *s = str, *end = str + len - needle_len + 1, *result;
+    __m128i a, b;
+    guint32 mask;
+
+    *stop = str + len;
+    for ( ; end - s >= 16; s += 16 ) {
+        a = _mm_loadu_si128( (const __m128i *)s );
+        b = _mm_loadu_si128( (const __m128i *)(s + needle_len - 1) );
+        mask = _mm_movemask_epi8( _mm_and_si128(
+                _mm_or_si128( _mm_cmpeq_epi8(a, first1),
+                              _mm_cmpeq_epi8(a, first2) ),
+                _mm_or_si128( _mm_cmpeq_epi8(b, last1),
+                              _mm_cmpeq_epi8(b, last2) ) ) );
+        if (mask) {
+            result = check_caseless_candidates( mask, needle, needle_len, s,
+                                                &checks, stop );
+            if ( result || *stop != str + len )
+                return result;
+        }
+    }
+
+    return find_caseless_scalar( needle, needle_len, s, str + len - s,
+                                 checks, stop );
+}
+
+/** Finds token in blocks of 32 bytes. */
+__attribute__((target("avx2")))
+const gchar *find_caseless_avx2( const gchar *needle,
+                                 gsize needle_len,
+                                 const gchar *str,
+                                 gsize len,
+                                 gsize checks,
+                                 const gchar **stop )
+{
+    const gchar last = needle[needle_len - 1];
+    const __m256i first1 = _mm256_set1_epi8(needle[0]);
+    const __m256i first2 = _mm256_set1_epi8( g_ascii_toupper(needle[0]) );
+    const __m256i last1 = _mm256_set1_epi8(last);
+    const __m256i last2 = _mm256_set1_epi8( g_ascii_toupper(last) );
+    const gchar *s = str, *end = str + len - needle_len + 1, *result;
+    __m256i a, b;
+    guint32 mask;
+
+    *stop = str + len;
+    for ( ; end - s >= 32; s += 32 ) {
+        a = _mm256_loadu_si256( (const __m256i *)s );
+        b = _mm256_loadu_si256( (const __m256i *)(s + needle_len - 1) );
+        mask = _mm256_movemask_epi8( _mm256_and_si256(
+                _mm256_or_si256( _mm256_cmpeq_epi8(a, first1),
+                                 _mm256_cmpeq_epi8(a, first2) ),
+                _mm256_or_si256( _mm256_cmpeq_epi8(b, last1),
+                                 _mm256_cmpeq_epi8(b, last2) ) ) );
+        if (mask) {
+            result = check_caseless_candidates( mask, needle, needle_len, s,
+                                                &checks, stop );
+            if ( result || *stop != str + len )
+                return result;
+        }
+    }
+
+    return find_caseless_scalar( needle, needle_len, s, str + len - s,
+                                 checks, stop );
+}
+
+/** Finds token in blocks of 64 bytes. */
+__attribute__((target("avx512bw")))
+const gchar *find_caseless_avx512( const gchar *needle,
+                                   gsize needle_len,
+                                   const gchar *str,
+                                   gsize len,
+                                   gsize checks,
+                                   const gchar **stop )
+{
+    const gchar last = needle[needle_len - 1];
+    const __m512i first1 = _mm512_set1_epi8(needle[0]);
+    const __m512i first2 = _mm512_set1_epi8( g_ascii_toupper(needle[0]) );
+    const __m512i last1 = _mm512_set1_epi8(last);
+    const __m512i last2 = _mm512_set1_epi8( g_ascii_toupper(last) );
+    const gchar *s = str, *end = str + len - needle_len + 1, *result;
+    __m512i a, b;
+    guint64 mask;
+
+    *stop = str + len;
+    for ( ; end - s >= 64; s += 64 ) {
+        a = _mm512_loadu_si512( (const void *)s );
+        b = _mm512_loadu_si512( (const void *)(s + needle_len - 1) );
+        mask = ( _mm512_cmpeq_epi8_mask(a, first1)
+               | _mm512_cmpeq_epi8_mask(a, first2) )
+             & ( _mm512_cmpeq_epi8_mask(b, last1)
+               | _mm512_cmpeq_epi8_mask(b, last2) );
+        if ((guint32)mask) {
+            result = check_caseless_candidates( (guint32)mask,
+                                                needle, needle_len, s,
+                                                &checks, stop );
+            if ( result || *stop != str + len )
+                return result;
+        }
+        if (mask >> 32) {
+            result = check_caseless_candidates( mask >> 32,
+                                                needle, needle_len, s + 32,
+                                                &checks, stop );
+            if ( result || *stop != str + len )
+                return result;
+        }
+    }
+
+    return find_caseless_scalar( needle, needle_len, s, str + len - s,
+                                 checks, stop );
+}
+#endif
+
+/** Kernels for each instruction set; the best supported one comes first. */
+const ScanVariant scan_variants[] = {
+#ifdef SCAN_X86
+    {"avx512bw", find_separator_avx512, find_caseless_avx512},
+    {"avx2",     find_separator_avx2,   find_caseless_avx2},
+    {"sse2",     find_separator_sse2,   find_caseless_sse2},
+#endif
+    {"scalar",   find_separator_scalar, find_caseless_scalar}
+};
+
+/** Kernels in use (see #scan_init). */
+const ScanVariant *scan_variant =
+    &scan_variants[ G_N_ELEMENTS(scan_variants) - 1 ];
+
+/**
+ * Find separator in bytes.
+ * \returns pointer to first occurrence of \a sep in \a str, NULL if not found
+ */
+const gchar *find_separator( const gchar *sep,
+                             gsize sep_len,
+                             const gchar *str,
+                             gsize len )
+{
+    if ( !sep_len || sep_len > len )
+        return NULL;
+
+    return scan_variant->find_separator(sep, sep_len, str, len);
+}
+
+/**
+ * Finds token (case insensitive).
+ * Searches for lower case \a needle of length \a needle_len in \a len bytes
+ * of \a str. At most \a checks candidate positions are compared with whole
+ * needle; if the limit is reached, search stops.
+ * \a stop is set to position where the search stopped (\a str + \a len if
+ * the whole \a str was searched).
+ * \returns pointer to first occurrence of \a needle in \a str, NULL if not
+ * found before \a stop
+ */
+const gchar *find_caseless( const gchar *needle,
+                            gsize needle_len,
+                            const gchar *str,
+                            gsize len,
+                            gsize checks,
+                            const gchar **stop )
+{
+    if ( !needle_len || needle_len > len ) {
+        *stop = str + len;
+        return needle_len ? NULL : str;
+    }
+
+    if (!checks) {
+        *stop = str;
+        return NULL;
+    }
+
+    return scan_variant->find_caseless( needle, needle_len, str, len,
+                                        checks, stop );
+}
+
+/**
+ * Selects the fastest kernels supported by CPU.
+ * Should be called at startup before other threads are started.
+ */
+void scan_init(void)
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx512bw") )
+        scan_variant = &scan_variants[0];
+    else if ( __builtin_cpu_supports("avx2") )
+        scan_variant = &scan_variants[1];
+    else if ( __builtin_cpu_supports("sse2") )
+        scan_variant = &scan_variants[2];
+#endif
+}
+
+/** Returns name of instruction set used by kernels (see #scan_init). */
+const gchar *scan_get_variant(void)
+{
+    return scan_variant->name;
+}
@@ -0,0 +1,48 @@
+/**
+ * \file scan.h
+ *
+ * Searching for item separators in input and for filter tokens in items.
+ */
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <glib.h>
+
+/**\{ \name Kernel types */
+typedef const gchar *(*FindSeparatorFunc)( const gchar *sep,
+                                           gsize sep_len,
+                                           const gchar *str,
+                                           gsize len );
+typedef const gchar *(*FindCaselessFunc)( const gchar *needle,
+                                          gsize needle_len,
+                                          const gchar *str,
+                                          gsize len,
+                                          gsize checks,
+                                          const gchar **stop );
+/**\}*/
+
+/** kernels compiled for an instruction set */
+typedef struct {
+    /** instruction set name */
+    const gchar *name;
+    /** separator search (see #find_separator) */
+    FindSeparatorFunc find_separator;
+    /** case insensitive token search (see #find_caseless) */
+    FindCaselessFunc find_caseless;
+} ScanVariant;
+
+void scan_init(void);
+const gchar *scan_get_variant(void);
+
+const gchar *find_separator( const gchar *sep,
+                             gsize sep_len,
+                             const gchar *str,
+                             gsize len );
+const gchar *find_caseless( const gchar *needle,
+                            gsize needle_len,
+                            const gchar *str,
+                            gsize len,
+                            gsize checks,
+                            const gchar **stop );
+
+#endif /* SCAN_H */
@@ -0,0 +1,111 @@
+/**
+ * \file sort_key.c
+ *
+ * Sort keys of items.
+ *
+ * Sort key is computed once for each item (see reader.h) so that comparing
+ * two items is a single strcmp() instead of parsing both texts again for
+ * each of O(n log n) comparisons.
+ *
+ * Natural sort key (#sort_key_natural) orders numbers in text by value.
+ * Other bytes are shifted by one (so zero byte terminates the key) and two
+ * highest values are escaped. Each run of digits is replaced by
+ * #SORT_KEY_NUMBER, number of significant digits (base-255 number prefixed
+ * by its length) and the significant digits. Marker lies between shifted
+ * '/' and ':' so numbers sort against other bytes as digits do and longer
+ * numbers sort after shorter ones regardless of number of digits.
+ *
+ * Locale sort key (#sort_key_locale) is collation key for file names in
+ * current locale, so costly collation runs once for each item instead of
+ * once for each comparison.
+ */
+#include "sort_key.h"
+
+#include <string.h>
+
+/** marker of number in natural sort key */
+#define SORT_KEY_NUMBER ('0' + 1)
+
+/** first byte value which is escaped in sort key */
+#define SORT_KEY_ESCAPE 0xfe
+
+/**
+ * Maximum size of key of single byte of text
+ * (single digit is marker, two bytes of number length and the digit).
+ */
+#define SORT_KEY_MAX_EXPANSION 4
+
+/**
+ * Writes number of digits \a count in order-preserving encoding to \a out.
+ * \returns pointer after the written bytes
+ */
+guchar *sort_key_write_count(guchar *out, gsize count)
+{
+    guchar digits[sizeof(gsize) + 1];
+    guint i = 0;
+
+    do {
+        digits[i++] = count % 255 + 1;
+        count /= 255;
+    } while (count);
+
+    *out++ = i;
+    while (i)
+        *out++ = digits[--i];
+
+    return out;
+}
+
+/**
+ * Appends natural sort key of \a text to \a key.
+ * Numbers (runs of digits) are compared by value regardless of leading
+ * zeros and of their length; other bytes are compared as unsigned values.
+ */
+void sort_key_natural(GString *key, const gchar *text, gsize len)
+{
+    const guchar *s = (const guchar *)text, *end = s + len, *number;
+    gsize start = key->len;
+    guchar *out;
+
+    g_string_set_size(key, start + SORT_KEY_MAX_EXPANSION * len);
+    out = (guchar *)key->str + start;
+
+    while (s < end) {
+        if ( g_ascii_isdigit(*s) ) {
+            for ( ; s < end && *s == '0'; ++s );
+            for ( number = s; s < end && g_ascii_isdigit(*s); ++s );
+            *out++ = SORT_KEY_NUMBER;
+            out = sort_key_write_count(out, s - number);
+            memcpy(out, number, s - number);
+            out += s - number;
+        } else if (*s < SORT_KEY_ESCAPE) {
+            *out++ = *s++ + 1;
+        } else {
+            *out++ = SORT_KEY_ESCAPE + 1;
+            *out++ = *s++ - SORT_KEY_ESCAPE + 1;
+        }
+    }
+
+    g_string_truncate(key, out - (guchar *)key->str);
+}
+
+/**
+ * Appends locale sort key of \a text to \a key.
+ * Items are ordered as file names in current locale (see
+ * g_utf8_collate_key_for_filename()); invalid UTF-8 sequences are replaced
+ * before computing the key.
+ */
+void sort_key_locale(GString *key, const gchar *text, gsize len)
+{
+    gchar *valid, *collate_key;
+
+    /* collation needs valid zero-terminated UTF-8 */
+    valid = g_utf8_validate(text, len, NULL)
+        ? g_strndup(text, len) : g_utf8_make_valid(text, len);
+
+    collate_key = g_utf8_collate_key_for_filename(valid, -1);
+    g_string_append(key, collate_key);
+
+    g_free(collate_key);
+    g_free(valid);
+}
@@ -0,0 +1,21 @@
+/**
+ * \file sort_key.h
+ *
+ * Sort keys of items.
+ */
+#ifndef SORT_KEY_H
+#define SORT_KEY_H
+
+#include <glib.h>
+
+/**
+ * Appends sort key of \a text of length \a len to \a key.
+ * Keys don't contain zero bytes and items sort in the same order as their
+ * keys compared with strcmp() (or memcmp() including the terminator).
+ */
+typedef void (*SortKeyFunc)(GString *key, const gchar *text, gsize len);
+
+void sort_key_natural(GString *key, const gchar *text, gsize len);
+void sort_key_locale(GString *key, const gchar *text, gsize len);
+
+#endif /* SORT_KEY_H */
@@ -0,0 +1,370 @@
+/**
+ * \file sort_order.c
+ *
+ * Sort orders of items and cache of sorted item indexes.
+ *
+ * Items can be sorted while they are loaded using compare function of the
+ * order (#sort_order_get_compare, see item_view.h); orders by text compare
+ * sort keys computed by reader (#sort_order_get_key_func, see reader.h).
+ *
+ * After all items are loaded, #SortOrders keeps indexes of all items in
+ * each sort order (permutation of the store) and rank of each item (its
+ * position in the permutation) so view can switch between the orders
+ * without comparing items (see #item_view_reorder). Each order is built
+ * once on first request in background thread (#sort_orders_build) using
+ * parallel sort (see parallel_sort.h). Sort keys for other text order than
+ * the one computed by reader are computed by the build thread and freed
+ * after sorting.
+ *
+ * Order by score depends on filter text, so it's cached as input order and
+ * view ranks the items (see #item_view_rank).
+ */
+#include "sort_order.h"
+#include "parallel_sort.h"
+
+#include <string.h>
+
+struct _SortOrders {
+    /** item store (items must not be added) */
+    const ItemStore *store;
+    /** order of sort keys in store (see #item_store_get_key) */
+    SortOrder key_order;
+    /** number of threads for sorting */
+    guint threads;
+
+    /** indexes of all items in each order (guint, NULL if not built) */
+    GArray *items[NUM_SORT_ORDERS];
+    /** position of each item in SortOrders::items */
+    guint *ranks[NUM_SORT_ORDERS];
+
+    /** build thread (NULL if not running) */
+    GThread *thread;
+    /** order being built */
+    SortOrder building;
+    /** items sorted by build thread (added to cache in main thread) */
+    GArray *built;
+    /** ranks of SortOrders::built */
+    guint *built_ranks;
+    /** function called from main loop if order is built */
+    GSourceFunc func;
+    /** data for SortOrders::func */
+    gpointer data;
+};
+
+/** sort keys computed for sorting */
+typedef struct {
+    /** zero-terminated keys */
+    GString *keys;
+    /** offset of key of each item in SortKeys::keys */
+    gsize *offsets;
+} SortKeys;
+
+/** names of sort orders (option \c --sort) */
+const gchar *sort_order_names[NUM_SORT_ORDERS] = {
+    "input", "length", "score", "recency", "natural", "locale"
+};
+
+/** Returns name of sort \a order. */
+const gchar *sort_order_get_name(SortOrder order)
+{
+    return sort_order_names[order];
+}
+
+/**
+ * Finds sort order by \a name.
+ * \returns FALSE if there is no such order
+ */
+gboolean sort_order_from_name(const gchar *name, SortOrder *order)
+{
+    guint i;
+
+    for ( i = 0; i < NUM_SORT_ORDERS; ++i ) {
+        if ( strcmp(name, sort_order_names[i]) == 0 ) {
+            *order = i;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/** Returns function computing sort keys for \a order (NULL if not used). */
+SortKeyFunc sort_order_get_key_func(SortOrder order)
+{
+    switch (order) {
+        case SORT_NATURAL:
+            return sort_key_natural;
+        case SORT_LOCALE:
+            return sort_key_locale;
+        default:
+            return NULL;
+    }
+}
+
+/** Compares items by index (later items first). */
+gint sort_order_compare_recency(guint a, guint b, gpointer store)
+{
+    return (a < b) - (a > b);
+}
+
+/** Compares items by length (items with the same length by index). */
+gint sort_order_compare_length(guint a, guint b, gpointer store)
+{
+    gsize len_a = item_store_get_item(store, a)->len;
+    gsize len_b = item_store_get_item(store, b)->len;
+
+    if (len_a != len_b)
+        return len_a < len_b ? -1 : 1;
+
+    return (a > b) - (a < b);
+}
+
+/** Compares items by sort keys in store. */
+gint sort_order_compare_keys(guint a, guint b, gpointer store)
+{
+    return strcmp( item_store_get_key(store, a),
+                   item_store_get_key(store, b) );
+}
+
+/** Compares items by sort keys computed for sorting (#SortKeys). */
+gint sort_order_compare_sort_keys(guint a, guint b, gpointer data)
+{
+    const SortKeys *keys = (const SortKeys *)data;
+
+    return strcmp( keys->keys->str + keys->offsets[a],
+                   keys->keys->str + keys->offsets[b] );
+}
+
+/**
+ * Returns function for sorting items in \a order while they are loaded
+ * (user data is item store) or NULL if items are loaded in input order.
+ * Text orders compare sort keys in store.
+ */
+ItemCompareFunc sort_order_get_compare(SortOrder order)
+{
+    switch (order) {
+        case SORT_LENGTH:
+            return sort_order_compare_length;
+        case SORT_RECENCY:
+            return sort_order_compare_recency;
+        case SORT_NATURAL:
+        case SORT_LOCALE:
+            return sort_order_compare_keys;
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * Creates empty cache of item orders for items in \a store.
+ * Items must not be added to \a store afterwards.
+ * Store contains sort keys for \a key_order (see reader.h).
+ * Orders are sorted in \a threads threads (0 for number of processors).
+ */
+SortOrders *sort_orders_new( const ItemStore *store,
+                             SortOrder key_order,
+                             guint threads )
+{
+    SortOrders *orders = g_new0(SortOrders, 1);
+
+    orders->store = store;
+    orders->key_order = key_order;
+    orders->threads = threads;
+
+    return orders;
+}
+
+/** Waits for build thread and frees \a orders. */
+void sort_orders_free(SortOrders *orders)
+{
+    guint i;
+
+    if (orders->thread) {
+        g_thread_join(orders->thread);
+        if (orders->built)
+            g_array_unref(orders->built);
+        g_free(orders->built_ranks);
+    }
+
+    for ( i = 0; i < NUM_SORT_ORDERS; ++i ) {
+        if (orders->items[i])
+            g_array_unref(orders->items[i]);
+        g_free(orders->ranks[i]);
+    }
+    g_free(orders);
+}
+
+/** Returns position of each item in \a items. */
+guint *sort_orders_get_ranks(const GArray *items)
+{
+    const guint *data = (const guint *)items->data;
+    guint *ranks = g_new(guint, MAX(items->len, 1));
+    guint i;
+
+    for ( i = 0; i < items->len; ++i )
+        ranks[data[i]] = i;
+
+    return ranks;
+}
+
+/** Adds \a items in \a order and their \a ranks to cache (takes ownership). */
+void sort_orders_add( SortOrders *orders,
+                      SortOrder order,
+                      GArray *items,
+                      guint *ranks )
+{
+    if (order == SORT_SCORE)
+        order = SORT_INPUT;
+
+    if (orders->items[order])
+        g_array_unref(orders->items[order]);
+    g_free(orders->ranks[order]);
+    orders->items[order] = items;
+    orders->ranks[order] = ranks;
+}
+
+/**
+ * Adds \a items (indexes of all items in \a order) to cache.
+ * Takes ownership of \a items (one reference).
+ * Must be called from main thread.
+ */
+void sort_orders_set(SortOrders *orders, SortOrder order, GArray *items)
+{
+    sort_orders_add( orders, order, items, sort_orders_get_ranks(items) );
+}
+
+/**
+ * Returns indexes of all items in \a order (NULL if not built yet,
+ * see #sort_orders_build) and sets \a ranks to position of each item.
+ * Order by score is returned as input order.
+ */
+GArray *sort_orders_get( SortOrders *orders,
+                         SortOrder order,
+                         const guint **ranks )
+{
+    if (order == SORT_SCORE)
+        order = SORT_INPUT;
+
+    *ranks = orders->ranks[order];
+
+    return orders->items[order];
+}
+
+/** Computes sort keys of all items in \a order. */
+void sort_keys_init(SortKeys *keys, const ItemStore *store, SortOrder order)
+{
+    SortKeyFunc key_func = sort_order_get_key_func(order);
+    guint i, len = item_store_get_length(store);
+    const Item *item;
+
+    keys->keys = g_string_new(NULL);
+    keys->offsets = g_new(gsize, MAX(len, 1));
+    for ( i = 0; i < len; ++i ) {
+        item = item_store_get_item(store, i);
+        keys->offsets[i] = keys->keys->len;
+        key_func(keys->keys, item->text, item->len);
+        g_string_append_c(keys->keys, '\0');
+    }
+}
+
+/**
+ * Sorts items in background thread.
+ * Result is added to cache only in main thread (#sort_orders_built) so
+ * cache is never accessed from multiple threads.
+ */
+gpointer sort_orders_build_thread(SortOrders *orders)
+{
+    SortOrder order = orders->building;
+    guint i, len = item_store_get_length(orders->store);
+    GArray *items = g_array_sized_new( FALSE, FALSE, sizeof(guint), len );
+    guint *data;
+    SortKeys keys;
+
+    for ( i = 0; i < len; ++i )
+        g_array_append_val(items, i);
+    data = (guint *)items->data;
+
+    if (order == SORT_RECENCY) {
+        for ( i = 0; i < len; ++i )
+            data[i] = len - 1 - i;
+    } else if ( sort_order_get_key_func(order) &&
+                order != orders->key_order ) {
+        sort_keys_init(&keys, orders->store, order);
+        parallel_sort( data, len, sort_order_compare_sort_keys, &keys,
+                       orders->threads );
+        g_string_free(keys.keys, TRUE);
+        g_free(keys.offsets);
+    } else if ( sort_order_get_compare(order) ) {
+        parallel_sort( data, len, sort_order_get_compare(order),
+                       (gpointer)orders->store, orders->threads );
+    }
+
+    orders->built = items;
+    orders->built_ranks = sort_orders_get_ranks(items);
+
+    return NULL;
+}
+
+/** Adds built order to cache in main loop and calls SortOrders::func. */
+gboolean sort_orders_built(SortOrders *orders)
+{
+    g_thread_join(orders->thread);
+    orders->thread = NULL;
+
+    sort_orders_add( orders, orders->building,
+                     orders->built, orders->built_ranks );
+    orders->built = NULL;
+    orders->built_ranks = NULL;
+
+    return orders->func(orders->data);
+}
+
+/** Sorts items in background thread and calls SortOrders::func from main loop. */
+gpointer sort_orders_run(SortOrders *orders)
+{
+    sort_orders_build_thread(orders);
+    g_idle_add( (GSourceFunc)sort_orders_built, orders );
+
+    return NULL;
+}
+
+/**
+ * Starts building \a order in background thread.
+ * After the order is built (see #sort_orders_get), \a func is called
+ * with \a data from main event loop.
+ * \returns FALSE if the order is already built or other order is being
+ * built (\a func is not called)
+ */
+gboolean sort_orders_build( SortOrders *orders,
+                            SortOrder order,
+                            GSourceFunc func,
+                            gpointer data )
+{
+    if (order == SORT_SCORE)
+        order = SORT_INPUT;
+
+    if ( orders->items[order] || orders->thread )
+        return FALSE;
+
+    orders->building = order;
+    orders->func = func;
+    orders->data = data;
+    orders->thread = g_thread_new( "sort-order",
+                                   (GThreadFunc)sort_orders_run, orders );
+
+    return TRUE;
+}
+
+/** Returns memory used by cached orders in bytes. */
+gsize sort_orders_get_size(const SortOrders *orders)
+{
+    gsize size = 0;
+    guint i;
+
+    for ( i = 0; i < NUM_SORT_ORDERS; ++i ) {
+        if (orders->items[i])
+            size += 2 * orders->items[i]->len * sizeof(guint);
+    }
+
+    return size;
+}
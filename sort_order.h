@@ -0,0 +1,52 @@
+/**
+ * \file sort_order.h
+ *
+ * Sort orders of items and cache of sorted item indexes.
+ */
+#ifndef SORT_ORDER_H
+#define SORT_ORDER_H
+
+#include "item_view.h"
+#include "sort_key.h"
+
+/** item sort orders (option \c --sort) */
+typedef enum {
+    /** items are in input order */
+    SORT_INPUT,
+    /** shorter items first */
+    SORT_LENGTH,
+    /** best matching items first (items in input order are ranked) */
+    SORT_SCORE,
+    /** items read last first */
+    SORT_RECENCY,
+    /** numbers in items are compared by value (see #sort_key_natural) */
+    SORT_NATURAL,
+    /** items are collated in current locale (see #sort_key_locale) */
+    SORT_LOCALE,
+    /** number of sort orders */
+    NUM_SORT_ORDERS
+} SortOrder;
+
+/** cache of item indexes in each sort order */
+typedef struct _SortOrders SortOrders;
+
+const gchar *sort_order_get_name(SortOrder order);
+gboolean sort_order_from_name(const gchar *name, SortOrder *order);
+SortKeyFunc sort_order_get_key_func(SortOrder order);
+ItemCompareFunc sort_order_get_compare(SortOrder order);
+
+SortOrders *sort_orders_new( const ItemStore *store,
+                             SortOrder key_order,
+                             guint threads );
+void sort_orders_free(SortOrders *orders);
+void sort_orders_set(SortOrders *orders, SortOrder order, GArray *items);
+GArray *sort_orders_get( SortOrders *orders,
+                         SortOrder order,
+                         const guint **ranks );
+gboolean sort_orders_build( SortOrders *orders,
+                            SortOrder order,
+                            GSourceFunc func,
+                            gpointer data );
+gsize sort_orders_get_size(const SortOrders *orders);
+
+#endif /* SORT_ORDER_H */
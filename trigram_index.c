@@ -0,0 +1,304 @@
+/**
+ * \file trigram_index.c
+ *
+ * Index of case-folded trigrams in items.
+ *
+ * For each trigram (three consecutive bytes of item folded to lower case)
+ * index keeps posting list of items containing the trigram. Trigrams are
+ * hashed to #TRIGRAM_BUCKETS buckets; collisions only add candidates.
+ * Posting lists are stored one after another in single buffer as
+ * differences of ascending item indexes encoded in variable number of bytes
+ * (7 bits per byte), so most postings take single byte.
+ *
+ * Item matching a query contains all trigrams of all its tokens, so
+ * #trigram_index_find intersects posting lists of these trigrams (from the
+ * shortest) and returns candidates which have to be verified with
+ * #match_query. Long lists are skipped once there are only few candidates
+ * left since verifying candidates is cheaper than decoding the lists.
+ *
+ * Index is built in background thread (#trigram_index_new) in two passes
+ * over items: first computes size of each posting list, second writes the
+ * lists. Items must not change after the index is created.
+ */
+#include "trigram_index.h"
+
+#include <string.h>
+
+/** number of bits of trigram hash */
+#define TRIGRAM_BITS 20
+/** number of posting lists */
+#define TRIGRAM_BUCKETS (1 << TRIGRAM_BITS)
+
+/**
+ * Posting list is not intersected with candidates if it's longer
+ * (in bytes) than this multiple of number of candidates.
+ */
+#define TRIGRAM_SKIP_RATIO 8
+
+struct _TrigramIndex {
+    /** items (#Item, owned by store) */
+    const Item *items;
+    /** number of items */
+    guint len;
+
+    /** offset of each posting list (and end of the last one) */
+    gsize *offsets;
+    /** encoded posting lists */
+    guint8 *postings;
+
+    /** Index is built (set by build thread). */
+    gint ready;
+    /** build thread */
+    GThread *thread;
+    /** time (in microseconds) needed to build the index */
+    gint64 build_time;
+};
+
+/** Returns posting list number for trigram starting at \a s. */
+guint trigram_bucket(const gchar *s)
+{
+    guint32 trigram = (guint8)g_ascii_tolower(s[0]) << 16 |
+                      (guint8)g_ascii_tolower(s[1]) << 8 |
+                      (guint8)g_ascii_tolower(s[2]);
+
+    return (trigram * 2654435761u) >> (32 - TRIGRAM_BITS);
+}
+
+/** Returns number of bytes needed to encode \a value. */
+guint varint_size(guint32 value)
+{
+    guint size = 1;
+
+    while (value >= 0x80) {
+        value >>= 7;
+        ++size;
+    }
+
+    return size;
+}
+
+/**
+ * Encodes posting list entries of all items.
+ * If \a postings is NULL, only adds sizes of posting lists to \a sizes.
+ * Otherwise writes entries at \a offsets (which are advanced).
+ * \a last holds index plus one of last item added to each list.
+ */
+void trigram_index_scan( TrigramIndex *index,
+                         guint32 *last,
+                         gsize *sizes,
+                         gsize *offsets,
+                         guint8 *postings )
+{
+    const Item *item;
+    const gchar *s, *end;
+    guint i, bucket;
+    guint32 delta;
+
+    for ( i = 0; i < index->len; ++i ) {
+        item = &index->items[i];
+        if (item->len < 3)
+            continue;
+
+        end = item->text + item->len - 2;
+        for ( s = item->text; s < end; ++s ) {
+            bucket = trigram_bucket(s);
+            if (last[bucket] == i + 1)
+                continue;
+
+            delta = i + 1 - last[bucket];
+            last[bucket] = i + 1;
+            if (!postings) {
+                sizes[bucket] += varint_size(delta);
+                continue;
+            }
+
+            while (delta >= 0x80) {
+                postings[offsets[bucket]++] = (delta & 0x7f) | 0x80;
+                delta >>= 7;
+            }
+            postings[offsets[bucket]++] = delta;
+        }
+    }
+}
+
+/** Builds index in background thread. */
+gpointer trigram_index_build(TrigramIndex *index)
+{
+    gint64 start = g_get_monotonic_time();
+    guint32 *last = g_new0(guint32, TRIGRAM_BUCKETS);
+    gsize *sizes = g_new0(gsize, TRIGRAM_BUCKETS);
+    gsize *next = g_new(gsize, TRIGRAM_BUCKETS);
+    gsize total = 0;
+    guint i;
+
+    trigram_index_scan(index, last, sizes, NULL, NULL);
+
+    index->offsets = g_new(gsize, TRIGRAM_BUCKETS + 1);
+    for ( i = 0; i < TRIGRAM_BUCKETS; ++i ) {
+        index->offsets[i] = next[i] = total;
+        total += sizes[i];
+    }
+    index->offsets[TRIGRAM_BUCKETS] = total;
+    index->postings = g_malloc( MAX(total, 1) );
+
+    memset( last, 0, TRIGRAM_BUCKETS * sizeof(guint32) );
+    trigram_index_scan(index, last, NULL, next, index->postings);
+
+    g_free(last);
+    g_free(sizes);
+    g_free(next);
+
+    index->build_time = g_get_monotonic_time() - start;
+    g_atomic_int_set(&index->ready, TRUE);
+
+    return NULL;
+}
+
+/**
+ * Starts building index of items in \a store in background thread.
+ * Items must not be added to \a store afterwards.
+ */
+TrigramIndex *trigram_index_new(const ItemStore *store)
+{
+    TrigramIndex *index = g_new0(TrigramIndex, 1);
+
+    index->len = item_store_get_length(store);
+    index->items = index->len ? item_store_get_item(store, 0) : NULL;
+    index->thread = g_thread_new( "trigram-index",
+                                  (GThreadFunc)trigram_index_build, index );
+
+    return index;
+}
+
+/** Waits for build thread and frees \a index. */
+void trigram_index_free(TrigramIndex *index)
+{
+    g_thread_join(index->thread);
+    g_free(index->offsets);
+    g_free(index->postings);
+    g_free(index);
+}
+
+/** Returns TRUE if index is built and can be used. */
+gboolean trigram_index_is_ready(TrigramIndex *index)
+{
+    return g_atomic_int_get(&index->ready);
+}
+
+/** Returns size of posting list \a bucket in bytes. */
+gsize trigram_list_size(const TrigramIndex *index, guint bucket)
+{
+    return index->offsets[bucket + 1] - index->offsets[bucket];
+}
+
+/** Compares posting lists given by bucket numbers by size. */
+gint trigram_compare_lists(gconstpointer a, gconstpointer b, gpointer data)
+{
+    gsize size_a = trigram_list_size( data, *(const guint *)a );
+    gsize size_b = trigram_list_size( data, *(const guint *)b );
+
+    return (size_a > size_b) - (size_a < size_b);
+}
+
+/**
+ * Intersects \a candidates with posting list \a bucket.
+ * If \a first is TRUE, adds all items in the list to \a candidates instead.
+ */
+void trigram_intersect( const TrigramIndex *index,
+                        guint bucket,
+                        GArray *candidates,
+                        gboolean first )
+{
+    const guint8 *p = index->postings + index->offsets[bucket];
+    const guint8 *end = index->postings + index->offsets[bucket + 1];
+    guint32 id = 0, delta;
+    guint item, shift, i = 0, n = 0;
+    guint *c = (guint *)candidates->data;
+
+    while (p < end) {
+        delta = 0;
+        shift = 0;
+        do {
+            delta |= (guint32)(*p & 0x7f) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+        /* item index plus one */
+        id += delta;
+        item = id - 1;
+
+        if (first) {
+            g_array_append_val(candidates, item);
+            continue;
+        }
+
+        while ( i < candidates->len && c[i] < item )
+            ++i;
+        if (i == candidates->len)
+            break;
+        if (c[i] == item)
+            c[n++] = c[i++];
+    }
+
+    if (!first)
+        g_array_set_size(candidates, n);
+}
+
+/**
+ * Finds items which can match \a query.
+ * \returns new array of ascending item indexes (candidates which have to be
+ * verified with #match_query) or NULL if the index can't be used (no token
+ * of query is at least three bytes long)
+ */
+GArray *trigram_index_find(TrigramIndex *index, const Query *query)
+{
+    const QueryToken *token;
+    GArray *buckets, *candidates;
+    guint i, j, k, bucket;
+    gboolean found;
+
+    buckets = g_array_new( FALSE, FALSE, sizeof(guint) );
+    for ( i = 0; i < query->tokens->len; ++i ) {
+        token = &g_array_index(query->tokens, QueryToken, i);
+        for ( j = 0; j + 3 <= token->len; ++j ) {
+            bucket = trigram_bucket(token->text + j);
+            found = FALSE;
+            for ( k = 0; k < buckets->len && !found; ++k )
+                found = g_array_index(buckets, guint, k) == bucket;
+            if (!found)
+                g_array_append_val(buckets, bucket);
+        }
+    }
+
+    if (!buckets->len) {
+        g_array_free(buckets, TRUE);
+        return NULL;
+    }
+
+    g_array_sort_with_data(buckets, trigram_compare_lists, index);
+
+    candidates = g_array_new( FALSE, FALSE, sizeof(guint) );
+    for ( i = 0; i < buckets->len; ++i ) {
+        bucket = g_array_index(buckets, guint, i);
+        if ( i > 0 && ( candidates->len == 0 || trigram_list_size(index, bucket)
+                        > TRIGRAM_SKIP_RATIO * candidates->len ) )
+            break;
+        trigram_intersect(index, bucket, candidates, i == 0);
+    }
+
+    g_array_free(buckets, TRUE);
+
+    return candidates;
+}
+
+/** Returns memory used by index in bytes. */
+gsize trigram_index_get_size(TrigramIndex *index)
+{
+    return (TRIGRAM_BUCKETS + 1) * sizeof(gsize) +
+        index->offsets[TRIGRAM_BUCKETS];
+}
+
+/** Returns time (in microseconds) needed to build the index. */
+gint64 trigram_index_get_build_time(TrigramIndex *index)
+{
+    return index->build_time;
+}
@@ -0,0 +1,25 @@
+/**
+ * \file trigram_index.h
+ *
+ * Index of case-folded trigrams in items.
+ */
+#ifndef TRIGRAM_INDEX_H
+#define TRIGRAM_INDEX_H
+
+#include "item_store.h"
+#include "match.h"
+
+#include <glib.h>
+
+/** trigram index built in background thread */
+typedef struct _TrigramIndex TrigramIndex;
+
+TrigramIndex *trigram_index_new(const ItemStore *store);
+void trigram_index_free(TrigramIndex *index);
+gboolean trigram_index_is_ready(TrigramIndex *index);
+GArray *trigram_index_find(TrigramIndex *index, const Query *query);
+
+gsize trigram_index_get_size(TrigramIndex *index);
+gint64 trigram_index_get_build_time(TrigramIndex *index);
+
+#endif /* TRIGRAM_INDEX_H */